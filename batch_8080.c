@@ -0,0 +1,493 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "emulator_8080.h"
+#include "invaders_8080.h"
+#include "lanes_8080.h"
+
+/*
+ * Batch runner: runs every job of a job file on its own Space Invaders
+ * machine, spread over a pool of threads, and writes one line per job (in
+ * job order) with a hash of the final machine state and some stats.
+ * Build with:
+ *   cc -O2 -pthread -o batch_8080 batch_8080.c e8080_dissasemble.c emulator_8080.c invaders_8080.c lanes_8080.c -DEMULATOR_8080_NO_MAIN -DE8080_DISSASEMBLE_NO_MAIN
+ *
+ * A job line is
+ *   rom_dir cycles [input_script]
+ * with '#' starting a comment. An input script line is
+ *   frame port value
+ * and sets inputs[port] from the start of that frame on.
+ *
+ * Jobs are dealt round-robin to per-thread queues. A thread takes work from
+ * the back of its own queue and, once that is empty, steals from the front
+ * of the others', so a few slow jobs don't leave the other cores idle.
+ * A job that runs into HLT or an unused opcode stops the whole batch, as it
+ * does the emulator.
+ *
+ * With -l every LANES_8080 consecutive jobs are one unit of work, run in
+ * lockstep on the lanes of lanes_8080.c; a job leaves its group when it has
+ * run its cycles. Jobs run to the end of every frame either way, so each
+ * job's hash is the same with and without -l.
+ */
+
+#define MAX_THREADS 256
+#define MAX_LINE 4096
+
+struct Input8080 {
+	uint64_t frame;
+	uint8_t port;
+	uint8_t value;
+};
+
+struct Job8080 {
+	char rom_dir[MAX_LINE];
+	char script[MAX_LINE];      // empty: no input script
+	uint64_t cycles;
+	// results
+	int status;                 // 0 ok, -1 the ROM or script could not be read
+	uint64_t hash;              // FNV-1a of invaders_8080_snapshot
+	uint64_t frames;
+	double ms;
+	int thread;
+};
+
+// A thread's machines for -l
+struct LaneJobs8080 {
+	struct Lanes8080 lanes;
+	struct Invaders8080 machines[LANES_8080];
+	uint8_t *memory[LANES_8080];
+	struct Input8080 *inputs[LANES_8080];
+	int input_count[LANES_8080];
+	int next[LANES_8080];       // next input of each machine
+	uint64_t steps;             // lanes.steps and lanes.lane_steps, over all groups
+	uint64_t lane_steps;
+};
+
+// Job indices (group indices with -l); the owner pops from the back,
+// thieves from the front
+struct Queue8080 {
+	pthread_mutex_t lock;
+	int *jobs;
+	int front;
+	int back;
+};
+
+static struct Job8080 *jobs;
+static int job_count;
+static struct Queue8080 queues[MAX_THREADS];
+static int thread_count;
+static int use_decode;
+static int use_lanes;
+static uint64_t lane_steps[MAX_THREADS][2];  // per thread: steps, lane steps
+
+double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+uint64_t fnv1a_64(const uint8_t *bytes, int size)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+	for ( int i = 0; i < size; i++ )
+	{
+		hash = (hash ^ bytes[i]) * 0x100000001b3;
+	}
+	return hash;
+}
+
+// Returns -1 if the queue is empty
+int take_job(struct Queue8080 *queue, int own)
+{
+	int job = -1;
+	pthread_mutex_lock(&queue->lock);
+	if ( queue->front < queue->back )
+	{
+		job = own ? queue->jobs[--queue->back] : queue->jobs[queue->front++];
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return job;
+}
+
+// Returns the number of inputs read into *inputs, sorted by frame, or -1
+int load_script(const char *path, struct Input8080 **inputs)
+{
+	FILE *f = fopen(path, "r");
+	if ( f == NULL )
+	{
+		return -1;
+	}
+	int count = 0;
+	int capacity = 0;
+	*inputs = NULL;
+	char line[MAX_LINE];
+	while ( fgets(line, sizeof(line), f) != NULL )
+	{
+		unsigned long long frame;
+		unsigned port, value;
+		if ( sscanf(line, "%llu %u %u", &frame, &port, &value) != 3 || port >= INVADERS_INPUT_PORTS )
+		{
+			continue;
+		}
+		if ( count == capacity )
+		{
+			capacity = capacity ? capacity * 2 : 64;
+			*inputs = realloc(*inputs, capacity * sizeof(struct Input8080));
+		}
+		// scripts are written in frame order; keep it so when they are not
+		int at = count++;
+		while ( at > 0 && (*inputs)[at - 1].frame > frame )
+		{
+			(*inputs)[at] = (*inputs)[at - 1];
+			at--;
+		}
+		(*inputs)[at] = (struct Input8080){ frame, port, value };
+	}
+	fclose(f);
+	return count;
+}
+
+// Sets up 'machine' on 'memory' for 'job'; returns the number of inputs in
+// *inputs, or -1 if the ROM or script could not be read
+int start_job(struct Job8080 *job, struct Invaders8080 *machine, uint8_t *memory, struct Input8080 **inputs)
+{
+	int input_count = 0;
+	*inputs = NULL;
+	job->status = -1;
+	memset(memory, 0, MEMORY_SIZE_8080);
+	if ( load_rom_set_8080(memory, job->rom_dir, invaders_rom_set, INVADERS_ROM_PARTS, ROM_MMAP_8080) < 0 )
+	{
+		return -1;
+	}
+	if ( job->script[0] != '\0' && (input_count = load_script(job->script, inputs)) < 0 )
+	{
+		printf("error: Could not read %s\n", job->script);
+		return -1;
+	}
+	invaders_8080_init(machine, memory);
+	return input_count;
+}
+
+// Sets the inputs of the frame 'machine' is in; returns the next input
+int apply_inputs(struct Invaders8080 *machine, const struct Input8080 *inputs, int input_count, int next)
+{
+	while ( next < input_count && inputs[next].frame <= machine->frame )
+	{
+		machine->inputs[inputs[next].port] = inputs[next].value;
+		next++;
+	}
+	return next;
+}
+
+// Where the next slice of 'job' ends: at the end of the frame, so inputs
+// change as a frame starts whichever way the job runs, or of the job
+uint64_t slice_end(const struct Job8080 *job, const struct Invaders8080 *machine)
+{
+	uint64_t end = (machine->frame + 1) * INVADERS_FRAME_CYCLES;
+	return end < job->cycles ? end : job->cycles;
+}
+
+void finish_job(struct Job8080 *job, struct Invaders8080 *machine)
+{
+	static __thread uint8_t blob[INVADERS_SNAPSHOT_SIZE];
+	invaders_8080_snapshot(machine, blob, sizeof(blob));
+	job->hash = fnv1a_64(blob, sizeof(blob));
+	job->frames = machine->frame;
+	job->status = 0;
+}
+
+void run_job(struct Job8080 *job, uint8_t *memory, struct Decode8080 *decode)
+{
+	double start = now_ms();
+	struct Invaders8080 machine;
+	struct Input8080 *inputs;
+	int input_count = start_job(job, &machine, memory, &inputs);
+	if ( input_count < 0 )
+	{
+		return;
+	}
+	if ( decode != NULL )
+	{
+		initialize_decode(decode);
+		machine.state.decode = decode;
+		machine.scheduler.run = run_predecoded_8080;
+	}
+	int next = 0;
+	while ( machine.state.cycles < job->cycles )
+	{
+		next = apply_inputs(&machine, inputs, input_count, next);
+		run_scheduled_8080(&machine.state, &machine.scheduler, slice_end(job, &machine) - machine.state.cycles);
+	}
+	free(inputs);
+	finish_job(job, &machine);
+	job->ms = now_ms() - start;
+}
+
+// Runs jobs first .. first + count - 1 (count <= LANES_8080) together in
+// lockstep; each job's time is its share of the group's
+void run_lane_jobs(int first, int count, struct LaneJobs8080 *group)
+{
+	double start = now_ms();
+	struct State8080 *states[LANES_8080];
+	struct Scheduler8080 *schedulers[LANES_8080];
+	int active[LANES_8080];     // machines still running, by index
+	int lanes = 0;
+	for ( int i = 0; i < count; i++ )
+	{
+		group->input_count[i] = start_job(&jobs[first + i], &group->machines[i], group->memory[i], &group->inputs[i]);
+		group->next[i] = 0;
+		if ( group->input_count[i] >= 0 )
+		{
+			active[lanes++] = i;
+		}
+	}
+	while ( lanes > 0 )
+	{
+		// lanes stay in step, so they all run to the nearest slice end
+		uint64_t until = UINT64_MAX;
+		for ( int lane = 0; lane < lanes; lane++ )
+		{
+			int i = active[lane];
+			struct Invaders8080 *machine = &group->machines[i];
+			group->next[i] = apply_inputs(machine, group->inputs[i], group->input_count[i], group->next[i]);
+			uint64_t end = slice_end(&jobs[first + i], machine);
+			until = end < until ? end : until;
+			states[lane] = &machine->state;
+			schedulers[lane] = &machine->scheduler;
+		}
+		lanes_8080_load(&group->lanes, states, lanes);
+		run_scheduled_lanes_8080(&group->lanes, schedulers, until);
+		lanes_8080_store(&group->lanes);
+		group->steps += group->lanes.steps;
+		group->lane_steps += group->lanes.lane_steps;
+		for ( int lane = lanes - 1; lane >= 0; lane-- )
+		{
+			int i = active[lane];
+			if ( group->machines[i].state.cycles >= jobs[first + i].cycles )
+			{
+				finish_job(&jobs[first + i], &group->machines[i]);
+				free(group->inputs[i]);
+				active[lane] = active[--lanes];
+			}
+		}
+	}
+	double ms = (now_ms() - start) / count;
+	for ( int i = 0; i < count; i++ )
+	{
+		jobs[first + i].ms = ms;
+	}
+}
+
+void *worker(void *arg)
+{
+	int id = (int)(intptr_t)arg;
+	uint8_t *memory = alloc_memory_8080();
+	struct Decode8080 *decode = use_decode ? malloc(sizeof(struct Decode8080)) : NULL;
+	struct LaneJobs8080 *group = use_lanes ? aligned_alloc(64, sizeof(struct LaneJobs8080)) : NULL;
+	int lanes_ok = group != NULL;
+	if ( group != NULL )
+	{
+		memset(group, 0, sizeof(struct LaneJobs8080));
+	}
+	for ( int i = 0; i < LANES_8080 && lanes_ok; i++ )
+	{
+		lanes_ok = (group->memory[i] = alloc_memory_8080()) != NULL;
+	}
+	if ( memory == NULL || (use_decode && decode == NULL) || (use_lanes && !lanes_ok) )
+	{
+		puts("error: Could not allocate guest memory");
+		exit(1);
+	}
+	for ( ;; )
+	{
+		int job = take_job(&queues[id], 1);
+		// own queue empty: steal, starting with the next thread's
+		for ( int i = 1; job < 0 && i < thread_count; i++ )
+		{
+			job = take_job(&queues[(id + i) % thread_count], 0);
+		}
+		if ( job < 0 )
+		{
+			break;
+		}
+		if ( use_lanes )
+		{
+			int first = job * LANES_8080;
+			int count = job_count - first < LANES_8080 ? job_count - first : LANES_8080;
+			for ( int i = 0; i < count; i++ )
+			{
+				jobs[first + i].thread = id;
+			}
+			run_lane_jobs(first, count, group);
+			continue;
+		}
+		jobs[job].thread = id;
+		run_job(&jobs[job], memory, decode);
+	}
+	if ( group != NULL )
+	{
+		lane_steps[id][0] = group->steps;
+		lane_steps[id][1] = group->lane_steps;
+		for ( int i = 0; i < LANES_8080; i++ )
+		{
+			free_memory_8080(group->memory[i]);
+		}
+		free(group);
+	}
+	free(decode);
+	free_memory_8080(memory);
+	return NULL;
+}
+
+int load_jobs(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if ( f == NULL )
+	{
+		printf("error: Could not open %s\n", path);
+		return -1;
+	}
+	int capacity = 0;
+	char line[MAX_LINE];
+	while ( fgets(line, sizeof(line), f) != NULL )
+	{
+		char *comment = strchr(line, '#');
+		if ( comment != NULL )
+		{
+			*comment = '\0';
+		}
+		struct Job8080 job = { 0 };
+		unsigned long long cycles;
+		int fields = sscanf(line, "%4095s %llu %4095s", job.rom_dir, &cycles, job.script);
+		if ( fields <= 0 )
+		{
+			continue;
+		}
+		if ( fields < 2 )
+		{
+			printf("error: %s: expected 'rom_dir cycles [input_script]': %s", path, line);
+			fclose(f);
+			return -1;
+		}
+		job.cycles = cycles;
+		if ( job_count == capacity )
+		{
+			capacity = capacity ? capacity * 2 : 256;
+			jobs = realloc(jobs, capacity * sizeof(struct Job8080));
+		}
+		jobs[job_count++] = job;
+	}
+	fclose(f);
+	return job_count;
+}
+
+int main(int argc, char *argv[])
+{
+	// usage: batch_8080 [-j threads] [-o out_file] [-d | -l] job_file
+	const char *out_path = NULL;
+	thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+	while ( (opt = getopt(argc, argv, "j:o:dl")) != -1 )
+	{
+		switch (opt)
+		{
+			case 'j': thread_count = atoi(optarg); break;
+			case 'o': out_path = optarg; break;
+			case 'd': use_decode = 1; break;
+			case 'l': use_lanes = 1; break;
+			default:
+				printf("usage: %s [-j threads] [-o out_file] [-d | -l] job_file\n", argv[0]);
+				exit(1);
+		}
+	}
+	if ( optind >= argc )
+	{
+		printf("usage: %s [-j threads] [-o out_file] [-d | -l] job_file\n", argv[0]);
+		exit(1);
+	}
+	if ( thread_count < 1 || thread_count > MAX_THREADS )
+	{
+		thread_count = thread_count < 1 ? 1 : MAX_THREADS;
+	}
+	if ( load_jobs(argv[optind]) < 0 )
+	{
+		exit(1);
+	}
+
+	if ( use_lanes )
+	{
+		use_decode = 0;
+	}
+	int units = use_lanes ? (job_count + LANES_8080 - 1) / LANES_8080 : job_count;
+	for ( int t = 0; t < thread_count; t++ )
+	{
+		pthread_mutex_init(&queues[t].lock, NULL);
+		queues[t].jobs = malloc((units / thread_count + 1) * sizeof(int));
+		queues[t].front = 0;
+		queues[t].back = 0;
+	}
+	// dealt in reverse so each thread pops its jobs in file order
+	for ( int unit = units - 1; unit >= 0; unit-- )
+	{
+		struct Queue8080 *queue = &queues[unit % thread_count];
+		queue->jobs[queue->back++] = unit;
+	}
+
+	double start = now_ms();
+	pthread_t threads[MAX_THREADS];
+	for ( int t = 0; t < thread_count; t++ )
+	{
+		if ( pthread_create(&threads[t], NULL, worker, (void *)(intptr_t)t) != 0 )
+		{
+			puts("error: Could not start a thread");
+			exit(1);
+		}
+	}
+	for ( int t = 0; t < thread_count; t++ )
+	{
+		pthread_join(threads[t], NULL);
+	}
+	double elapsed = now_ms() - start;
+
+	FILE *out = out_path != NULL ? fopen(out_path, "w") : stdout;
+	if ( out == NULL )
+	{
+		printf("error: Could not write %s\n", out_path);
+		exit(1);
+	}
+	// job rom_dir cycles script status hash frames ms thread
+	int failed = 0;
+	uint64_t cycles = 0;
+	double busy = 0;
+	for ( int i = 0; i < job_count; i++ )
+	{
+		struct Job8080 *job = &jobs[i];
+		fprintf(out, "%d %s %llu %s %s %016llx %llu %.3f %d\n", i, job->rom_dir, (unsigned long long)job->cycles, job->script[0] ? job->script : "-", job->status == 0 ? "ok" : "error", (unsigned long long)job->hash, (unsigned long long)job->frames, job->ms, job->thread);
+		failed += job->status != 0;
+		cycles += job->status == 0 ? job->cycles : 0;
+		busy += job->ms;
+	}
+	fprintf(out, "# %d jobs, %d failed, %d threads, %.1f ms, %.1f ms of job time, %.1f MHz emulated\n", job_count, failed, thread_count, elapsed, busy, cycles / elapsed / 1e3);
+	if ( use_lanes )
+	{
+		uint64_t steps = 0;
+		uint64_t lane_total = 0;
+		for ( int t = 0; t < thread_count; t++ )
+		{
+			steps += lane_steps[t][0];
+			lane_total += lane_steps[t][1];
+		}
+		fprintf(out, "# %.1f lanes per step\n", steps ? (double)lane_total / steps : 0.0);
+	}
+	if ( out != stdout )
+	{
+		fclose(out);
+	}
+	return failed != 0;
+}
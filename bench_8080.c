@@ -0,0 +1,481 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "emulator_8080.h"
+#include "frame_8080.h"
+#include "invaders_8080.h"
+#include "jit_8080.h"
+#include "lanes_8080.h"
+
+/*
+ * Microbenchmarks for hot emulator helpers.
+ * Build with:
+ *   cc -O2 -o bench_8080 bench_8080.c e8080_dissasemble.c emulator_8080.c frame_8080.c invaders_8080.c jit_8080.c lanes_8080.c -DEMULATOR_8080_NO_MAIN -DE8080_DISSASEMBLE_NO_MAIN
+ * and run it where the Space Invaders ROM images are to check the game's
+ * rewind too.
+ */
+
+#define BENCH_OPERANDS 4096     // power of two
+#define BENCH_ITERATIONS 50000000
+#define BENCH_FRAMES 20000
+#define BENCH_SNAPSHOTS 2000
+#define BENCH_REWIND_FRAMES 120
+
+static uint8_t operands[BENCH_OPERANDS];
+
+double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// The flag computation as it was before the Z/S/P table: a bit counting
+// loop per result. Kept here as the baseline the table is measured against.
+uint8_t loop_parity(uint8_t byte)
+{
+	uint8_t count = 0;
+	while ( byte )
+	{
+		count += byte & 0x1;
+		byte >>= 1;
+	}
+	return !(count & 0x1);
+}
+
+void loop_add_8080(struct State8080 *state, uint8_t reg, uint8_t carry)
+{
+	uint16_t result = (uint16_t)state->a + (uint16_t)reg;
+	uint8_t auxiliary = ((state->a) & 0xf) + (reg & 0xf);
+	if ( carry )
+	{
+		result += state->cf.cy;
+		auxiliary += state->cf.cy;
+	}
+	state->cf.z = ((result & 0xff) == 0);
+	state->cf.cy = (result > 0xff);
+	state->cf.s = ((result & 0x80) != 0);
+	state->cf.p = loop_parity(result & 0xff);
+	state->cf.ac = (auxiliary > 0xf);
+	state->a = result & 0xff;
+}
+
+void loop_and_8080(struct State8080 *state, uint8_t reg)
+{
+	state->a &= reg;
+	state->cf.cy = 0;
+	state->cf.z = (state->a == 0);
+	state->cf.s = state->a >> 7;
+	state->cf.p = loop_parity(state->a);
+}
+
+void loop_inr_8080(struct State8080 *state, uint8_t *reg)
+{
+	uint8_t res = *reg + 1;
+	state->cf.z = (res == 0);
+	state->cf.s = res >> 7;
+	state->cf.p = loop_parity(res);
+	state->cf.ac = ((*reg & 0xf) == 0xf);
+	*reg = res;
+}
+
+void loop_cmp_8080(struct State8080 *state, uint8_t reg)
+{
+	uint8_t tmp = state->a - reg;
+	state->cf.cy = (state->a < reg);
+	state->cf.z = (tmp == 0);
+	state->cf.s = tmp >> 7;
+	state->cf.p = loop_parity(tmp);
+	state->cf.ac = ((state->a & 0xf) < (reg & 0xf));
+}
+
+// Each benchmark feeds the helper a stream of operands and reports ns per call
+#define BENCH_ALU(name, call) \
+	do \
+	{ \
+		initialize_state(&state, 0, NULL); \
+		double start = now_ns(); \
+		for ( long i = 0; i < BENCH_ITERATIONS; i++ ) \
+		{ \
+			uint8_t operand = operands[i & (BENCH_OPERANDS - 1)]; \
+			call; \
+		} \
+		double elapsed = now_ns() - start; \
+		printf("%-24s %6.2f ns/op  (A=%02x)\n", name, elapsed / BENCH_ITERATIONS, state.a); \
+	} while (0)
+
+void bench_flags(void)
+{
+	struct State8080 state;
+	puts("ALU flag computation: bit loop (before) vs Z/S/P table (after)");
+	BENCH_ALU("ADD  bit loop", loop_add_8080(&state, operand, 0));
+	BENCH_ALU("ADD  table", add_8080(&state, operand, 0));
+	BENCH_ALU("ANA  bit loop", (state.a ^= operand, loop_and_8080(&state, operand | 0x5a)));
+	BENCH_ALU("ANA  table", (state.a ^= operand, and_8080(&state, operand | 0x5a)));
+	BENCH_ALU("INR  bit loop", (state.b ^= operand, loop_inr_8080(&state, &state.b)));
+	BENCH_ALU("INR  table", (state.b ^= operand, inr_8080(&state, &state.b)));
+	BENCH_ALU("CMP  bit loop", (state.a ^= operand, loop_cmp_8080(&state, operand)));
+	BENCH_ALU("CMP  table", (state.a ^= operand, cmp_8080(&state, operand)));
+}
+
+// A small loop mixing moves, ALU, memory stores and conditional branches
+static const uint8_t loop_program[] = {
+	0x21, 0x00, 0x40,   // 0000 LXI H,$4000
+	0x06, 0x00,         // 0003 MVI B,#$00
+	0x78,               // 0005 MOV A,B
+	0x81,               // 0006 ADD C
+	0xaa,               // 0007 XRA D
+	0x1c,               // 0008 INR E
+	0x77,               // 0009 MOV M,A
+	0x23,               // 000a INX H
+	0xfe, 0x80,         // 000b CPI #$80
+	0xca, 0x10, 0x00,   // 000d JZ $0010
+	0x05,               // 0010 DCR B
+	0xc2, 0x05, 0x00,   // 0011 JNZ $0005
+	0xc3, 0x00, 0x00,   // 0014 JMP $0000
+};
+
+void bench_dispatch(void)
+{
+	static uint8_t memory[0x10000];
+	struct State8080 state;
+	memcpy(memory, loop_program, sizeof(loop_program));
+	puts("Dispatch: emulate_8080 per instruction vs threaded run_for_cycles_8080, run_predecoded_8080 and run_jit_8080");
+
+	initialize_state(&state, 0, memory);
+	double start = now_ns();
+	for ( long i = 0; i < BENCH_ITERATIONS; i++ )
+	{
+		emulate_8080(&state);
+	}
+	double elapsed = now_ns() - start;
+	printf("%-24s %6.2f ns/instruction  %6.1f MIPS\n", "switch", elapsed / BENCH_ITERATIONS, BENCH_ITERATIONS / elapsed * 1e3);
+
+	// time the same number of clock cycles the switch loop executed
+	uint64_t budget = state.cycles;
+	initialize_state(&state, 0, memory);
+	start = now_ns();
+	while ( state.cycles < budget )
+	{
+		run_for_cycles_8080(&state, 33333);
+	}
+	elapsed = now_ns() - start;
+	printf("%-24s %6.2f ns/instruction  %6.1f MIPS\n", "threaded", elapsed / BENCH_ITERATIONS, BENCH_ITERATIONS / elapsed * 1e3);
+
+	static struct Decode8080 decode;
+	initialize_decode(&decode);
+	initialize_state(&state, 0, memory);
+	state.decode = &decode;
+	start = now_ns();
+	while ( state.cycles < budget )
+	{
+		run_predecoded_8080(&state, 33333);
+	}
+	elapsed = now_ns() - start;
+	printf("%-24s %6.2f ns/instruction  %6.1f MIPS\n", "predecoded", elapsed / BENCH_ITERATIONS, BENCH_ITERATIONS / elapsed * 1e3);
+
+	initialize_state(&state, 0, memory);
+	struct Jit8080 *jit = jit_8080_create(&state);
+	if ( jit == NULL )
+	{
+		puts("translated               not supported on this host");
+		return;
+	}
+	start = now_ns();
+	while ( state.cycles < budget )
+	{
+		run_jit_8080(&state, 33333);
+	}
+	elapsed = now_ns() - start;
+	printf("%-24s %6.2f ns/instruction  %6.1f MIPS  (%.1f%% of cycles native)\n", "translated", elapsed / BENCH_ITERATIONS, BENCH_ITERATIONS / elapsed * 1e3, 100.0 * jit->native_cycles / state.cycles);
+	jit_8080_destroy(jit);
+}
+
+// loop_program on every lane with other data in C and D, against running
+// each CPU alone; returns the number of lanes that ended up different
+int bench_lanes(void)
+{
+	static struct State8080 states[LANES_8080];
+	static struct State8080 alone[LANES_8080];
+	struct State8080 *lane_states[LANES_8080];
+	uint64_t budget = BENCH_ITERATIONS / LANES_8080 * 5;
+	printf("Lanes: %d CPUs in lockstep vs one by one with run_for_cycles_8080 (%s)\n", LANES_8080, lanes_8080_vector() ? "AVX2" : "scalar");
+	for ( int i = 0; i < LANES_8080; i++ )
+	{
+		uint8_t *memory = alloc_memory_8080();
+		uint8_t *alone_memory = alloc_memory_8080();
+		if ( memory == NULL || alone_memory == NULL )
+		{
+			puts("error: Could not allocate guest memory");
+			exit(1);
+		}
+		memcpy(memory, loop_program, sizeof(loop_program));
+		memcpy(alone_memory, loop_program, sizeof(loop_program));
+		initialize_state(&states[i], 0, memory);
+		initialize_state(&alone[i], 0, alone_memory);
+		states[i].c = alone[i].c = operands[i];
+		states[i].d = alone[i].d = operands[LANES_8080 + i];
+		lane_states[i] = &states[i];
+	}
+
+	double start = now_ns();
+	// both run to the same cycles, so they stop at the same instructions
+	for ( int i = 0; i < LANES_8080; i++ )
+	{
+		for ( uint64_t until = 33333; alone[i].cycles < budget; until += 33333 )
+		{
+			run_for_cycles_8080(&alone[i], until - alone[i].cycles);
+		}
+	}
+	double alone_ns = now_ns() - start;
+
+	static struct Lanes8080 lanes;
+	lanes_8080_load(&lanes, lane_states, LANES_8080);
+	start = now_ns();
+	for ( uint64_t until = 33333; lanes.cycles[0] < budget; until += 33333 )
+	{
+		run_lanes_8080(&lanes, until);
+	}
+	double lanes_ns = now_ns() - start;
+	lanes_8080_store(&lanes);
+
+	int mismatches = 0;
+	for ( int i = 0; i < LANES_8080; i++ )
+	{
+		struct State8080 *a = &states[i];
+		struct State8080 *b = &alone[i];
+		mismatches += a->pc != b->pc || a->cycles != b->cycles || a->a != b->a || a->b != b->b || a->c != b->c || a->d != b->d
+			|| a->e != b->e || a->h != b->h || a->l != b->l || a->sp != b->sp || psw_8080(a) != psw_8080(b)
+			|| memcmp(a->memory, b->memory, MEMORY_SIZE_8080) != 0;
+		free_memory_8080(a->memory);
+		free_memory_8080(b->memory);
+	}
+	printf("%-24s %8.2f ms\n", "one by one", alone_ns / 1e6);
+	printf("%-24s %8.2f ms  (%.2fx, %.1f lanes per step, %d of %d lanes differ)\n", "lockstep", lanes_ns / 1e6, alone_ns / lanes_ns, (double)lanes.lane_steps / lanes.steps, mismatches, LANES_8080);
+	return mismatches;
+}
+
+// Snapshot number k: a fixed blob with a few bytes changed per snapshot
+void fill_snapshot(uint8_t *blob, int k)
+{
+	for ( int i = 0; i < SNAPSHOT_8080_SIZE; i++ )
+	{
+		blob[i] = i * 7 >> 8;
+	}
+	for ( int i = 0; i <= k; i++ )
+	{
+		blob[(i * 4099 + 26) % SNAPSHOT_8080_SIZE] = i;
+		blob[(i * 97 + 0x2400) % SNAPSHOT_8080_SIZE] ^= i + 1;
+	}
+}
+
+// Checks that a history of 'keep' snapshots gives back the newest ones, then
+// seeks down to the oldest; returns the number of wrong results
+int check_rewind(int keep, uint8_t *blob, uint8_t *expected)
+{
+	struct Rewind8080 rewind;
+	uint64_t found;
+	int errors = 0;
+	if ( rewind_8080_init(&rewind, SNAPSHOT_8080_SIZE, 0, keep, SIZE_MAX) < 0 )
+	{
+		puts("error: Could not allocate the rewind history");
+		exit(1);
+	}
+	for ( int k = 0; k < 10; k++ )
+	{
+		fill_snapshot(blob, k);
+		rewind_8080_push(&rewind, blob, 10 * k);
+		errors += rewind.states != (k + 1 < keep ? k + 1 : keep);
+	}
+	// asking for a tag between two snapshots gives the older one, and an
+	// older tag than any kept gives the oldest
+	for ( int k = 9; k >= 9 - keep; k-- )
+	{
+		int got = k > 9 - keep ? k : 10 - keep;
+		fill_snapshot(expected, got);
+		errors += rewind_8080_seek(&rewind, 10 * k + 5, blob, &found) != 0 || found != (uint64_t)(10 * got)
+			|| memcmp(blob, expected, SNAPSHOT_8080_SIZE) != 0 || rewind.states != got - (10 - keep) + 1;
+	}
+	rewind_8080_free(&rewind);
+	printf("%-24s %s\n", keep == 1 ? "keep 1 snapshot" : keep == 2 ? "keep 2 snapshots" : "keep 3 snapshots", errors ? "FAILED" : "ok");
+	return errors;
+}
+
+// rewind_8080_push and rewind_8080_seek on snapshots that differ in a few
+// bytes, after checking small histories; returns the number of failed checks
+int bench_rewind(void)
+{
+	static uint8_t blob[SNAPSHOT_8080_SIZE];
+	static uint8_t expected[SNAPSHOT_8080_SIZE];
+	puts("Rewind: snapshot history with every older snapshot kept as a delta");
+	int failed = 0;
+	for ( int keep = 1; keep <= 3; keep++ )
+	{
+		failed += check_rewind(keep, blob, expected) != 0;
+	}
+
+	struct Rewind8080 rewind;
+	uint64_t found;
+	if ( rewind_8080_init(&rewind, SNAPSHOT_8080_SIZE, 0, BENCH_SNAPSHOTS, SIZE_MAX) < 0 )
+	{
+		puts("error: Could not allocate the rewind history");
+		exit(1);
+	}
+	fill_snapshot(blob, -1);    // the blob before any change
+	double start = now_ns();
+	for ( int k = 0; k < BENCH_SNAPSHOTS; k++ )
+	{
+		// the two bytes snapshot k changes
+		blob[(k * 4099 + 26) % SNAPSHOT_8080_SIZE] = k;
+		blob[(k * 97 + 0x2400) % SNAPSHOT_8080_SIZE] ^= k + 1;
+		rewind_8080_push(&rewind, blob, k);
+	}
+	double push_ns = (now_ns() - start) / BENCH_SNAPSHOTS;
+	size_t bytes = rewind.bytes;
+	start = now_ns();
+	rewind_8080_seek(&rewind, BENCH_SNAPSHOTS / 2, blob, &found);
+	double seek_ns = now_ns() - start;
+	fill_snapshot(expected, BENCH_SNAPSHOTS / 2);
+	int wrong = found != BENCH_SNAPSHOTS / 2 || memcmp(blob, expected, SNAPSHOT_8080_SIZE) != 0;
+	failed += wrong;
+	rewind_8080_free(&rewind);
+	printf("%-24s %8.2f us/snapshot  (%.1f bytes each)\n", "push", push_ns / 1e3, (double)bytes / (BENCH_SNAPSHOTS - 1));
+	printf("%-24s %8.2f us  (%d snapshots back, %s)\n", "seek", seek_ns / 1e3, BENCH_SNAPSHOTS / 2, wrong ? "FAILED" : "ok");
+	return failed;
+}
+
+// Space Invaders saved every 6 frames while a coin goes in and a game is
+// started between saves: going back to each of the last frames must give
+// the machine as it was when that frame began. Returns the number of
+// frames that differ.
+int bench_invaders_rewind(void)
+{
+	static uint8_t snapshot[INVADERS_SNAPSHOT_SIZE];
+	uint8_t *memory = alloc_memory_8080();
+	uint8_t *frames = malloc((size_t)BENCH_REWIND_FRAMES * INVADERS_SNAPSHOT_SIZE);
+	struct Rewind8080 rewind;
+	if ( memory == NULL || frames == NULL || rewind_8080_init(&rewind, INVADERS_SNAPSHOT_SIZE, INVADERS_INPUT_PORTS, 64, SIZE_MAX) < 0 )
+	{
+		puts("error: Could not allocate the rewind history");
+		exit(1);
+	}
+	if ( load_rom_set_8080(memory, NULL, invaders_rom_set, INVADERS_ROM_PARTS, 0) < 0 )
+	{
+		printf("%-24s skipped, no ROM images here\n", "invaders rewind");
+		rewind_8080_free(&rewind);
+		free(frames);
+		free_memory_8080(memory);
+		return 0;
+	}
+	struct Invaders8080 machine;
+	invaders_8080_init(&machine, memory);
+	for ( int f = 0; f < BENCH_REWIND_FRAMES; f++ )
+	{
+		invaders_8080_snapshot(&machine, &frames[(size_t)f * INVADERS_SNAPSHOT_SIZE], INVADERS_SNAPSHOT_SIZE);
+		if ( f % 6 == 0 )
+		{
+			invaders_8080_rewind_save(&machine, &rewind);
+		}
+		// coin for frames 100-102, 1P start for 105-106
+		machine.inputs[1] = 0x08 | (f >= 100 && f <= 102) | (f >= 105 && f <= 106) << 2;
+		run_scheduled_8080(&machine.state, &machine.scheduler, (f + 1) * INVADERS_FRAME_CYCLES - machine.state.cycles);
+	}
+	int differ = 0;
+	for ( int f = BENCH_REWIND_FRAMES - 1; f >= 90; f-- )
+	{
+		differ += invaders_8080_rewind(&machine, &rewind, f) != f
+			|| invaders_8080_snapshot(&machine, snapshot, INVADERS_SNAPSHOT_SIZE) < 0
+			|| memcmp(snapshot, &frames[(size_t)f * INVADERS_SNAPSHOT_SIZE], INVADERS_SNAPSHOT_SIZE) != 0;
+	}
+	printf("%-24s %s (%d of %d frames differ)\n", "invaders rewind", differ ? "FAILED" : "ok", differ, BENCH_REWIND_FRAMES - 90);
+	rewind_8080_free(&rewind);
+	free(frames);
+	free_memory_8080(memory);
+	return differ;
+}
+
+void bench_frame(void)
+{
+	static uint8_t memory[0x10000];
+	static uint8_t gray[FRAME_8080_PIXELS];
+	static uint32_t rgba[FRAME_8080_PIXELS];
+	static const char *names[] = { "scalar", "sse2", "avx2" };
+	for ( int i = 0; i < FRAME_8080_VRAM_SIZE; i++ )
+	{
+		memory[FRAME_8080_VRAM + i] = operands[i & (BENCH_OPERANDS - 1)];
+	}
+	puts("Frame export: VRAM to 224x256 (one frame of emulation is 33333 cycles)");
+	for ( int kernel = FRAME_8080_SCALAR; kernel <= FRAME_8080_AVX2; kernel++ )
+	{
+		if ( frame_8080_use(kernel) != 0 )
+		{
+			printf("%-6s not supported on this host\n", names[kernel]);
+			continue;
+		}
+		double start = now_ns();
+		for ( int i = 0; i < BENCH_FRAMES; i++ )
+		{
+			memory[FRAME_8080_VRAM] = i;
+			frame_8080_gray(memory, gray);
+		}
+		double gray_ns = (now_ns() - start) / BENCH_FRAMES;
+		start = now_ns();
+		for ( int i = 0; i < BENCH_FRAMES; i++ )
+		{
+			memory[FRAME_8080_VRAM] = i;
+			frame_8080_rgba(memory, rgba, 0xffffffff, 0xff000000);
+		}
+		double rgba_ns = (now_ns() - start) / BENCH_FRAMES;
+		printf("%-6s gray %8.2f us/frame   rgba %8.2f us/frame  (%02x %08x)\n", names[kernel], gray_ns / 1e3, rgba_ns / 1e3, gray[0], rgba[0]);
+	}
+
+	// a typical Space Invaders frame writes to about ten columns
+	struct Dirty8080 dirty;
+	struct FrameHash8080 hash;
+	uint64_t total = 0;
+	initialize_dirty(&dirty, FRAME_8080_VRAM, FRAME_8080_VRAM_SIZE, FRAME_8080_COLUMN_SHIFT);
+	frame_8080_use(frame_8080_supported(FRAME_8080_AVX2) ? FRAME_8080_AVX2 : FRAME_8080_SSE2);
+	double start = now_ns();
+	for ( int i = 0; i < BENCH_FRAMES; i++ )
+	{
+		clear_dirty(&dirty);
+		for ( int column = 0; column < 10; column++ )
+		{
+			int x = operands[(i * 10 + column) & (BENCH_OPERANDS - 1)] % FRAME_8080_WIDTH;
+			dirty.lines[x >> 6] |= (uint64_t)1 << (x & 63);
+		}
+		frame_8080_gray_update(memory, gray, dirty.lines);
+	}
+	printf("%-24s %8.2f us/frame\n", "gray, 10 dirty columns", (now_ns() - start) / BENCH_FRAMES / 1e3);
+	start = now_ns();
+	for ( int i = 0; i < BENCH_FRAMES; i++ )
+	{
+		total += frame_8080_hash(memory, &hash, NULL);
+	}
+	printf("%-24s %8.2f us/frame\n", "hash, all columns", (now_ns() - start) / BENCH_FRAMES / 1e3);
+	start = now_ns();
+	for ( int i = 0; i < BENCH_FRAMES; i++ )
+	{
+		total += frame_8080_hash(memory, &hash, dirty.lines);
+	}
+	printf("%-24s %8.2f us/frame  (%016llx)\n", "hash, 10 dirty columns", (now_ns() - start) / BENCH_FRAMES / 1e3, (unsigned long long)total);
+}
+
+int main(int argc, char *argv[])
+{
+	srand(8080);
+	for ( int i = 0; i < BENCH_OPERANDS; i++ )
+	{
+		operands[i] = rand() & 0xff;
+	}
+	bench_flags();
+	bench_dispatch();
+	int failed = bench_lanes() != 0;
+	failed += bench_rewind();
+	failed += bench_invaders_rewind() != 0;
+	bench_frame();
+	return failed != 0;
+}
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "e8080_dissasemble.h"
+
 enum
 {
 	REG_A = 0x7,	// 111b
@@ -29,13 +31,40 @@ char register_name(unsigned char bitpattern)
 	}
 }
 
+int e8080_instruction_size(unsigned char opcode)
+{
+	if ( (opcode & 0xcf) == 0x01 ||    // LXI
+	     (opcode & 0xe7) == 0x22 ||    // SHLD, LHLD, STA, LDA
+	     (opcode & 0xc7) == 0xc2 ||    // Jcc
+	     (opcode & 0xc7) == 0xc4 ||    // Ccc
+	     opcode == 0xc3 || opcode == 0xcd )
+	{
+		return 3;
+	}
+	if ( (opcode & 0xc7) == 0x06 ||    // MVI
+	     (opcode & 0xc7) == 0xc6 ||    // ADI ... CPI
+	     opcode == 0xd3 || opcode == 0xdb )
+	{
+		return 2;
+	}
+	return 1;
+}
+
 /*
  * 'codebuffer' is a valid pointer to 8080 binary code
  * 'pc' is the current offset into the code
  */
 int e8080_dissasemble_opcode(unsigned char *codebuffer, int pc)
 {
-	unsigned char *code = &codebuffer[pc];
+	return e8080_dissasemble_instruction(&codebuffer[pc], pc);
+}
+
+/*
+ * 'code' points at the bytes of a single instruction
+ * 'pc' is the address printed in front of it
+ */
+int e8080_dissasemble_instruction(unsigned char *code, int pc)
+{
 	int opbytes = 1; // initializing to 1 as most of the structions have size 1
 	printf("%04x\t\t", pc); // printing offset into the code as a 16-bit hexadecimal address
 	const char *fmt;
@@ -1337,6 +1366,8 @@ int e8080_dissasemble_opcode(unsigned char *codebuffer, int pc)
 	return opbytes;
 }
 
+// Build with -DE8080_DISSASEMBLE_NO_MAIN to link the disassembler into other tools
+#ifndef E8080_DISSASEMBLE_NO_MAIN
 int main(int argc, char *argv[])
 {
 	FILE *f = fopen(argv[1], "rb"); // open binary file in read-only mode
@@ -1363,3 +1394,4 @@ int main(int argc, char *argv[])
 	}
 	return 0;
 }
+#endif
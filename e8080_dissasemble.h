@@ -0,0 +1,11 @@
+#ifndef E8080_DISSASEMBLE_H
+#define E8080_DISSASEMBLE_H
+
+// Both functions print one line to stdout and return the instruction size in bytes
+int e8080_dissasemble_opcode(unsigned char *codebuffer, int pc);
+int e8080_dissasemble_instruction(unsigned char *code, int pc);
+
+// Size in bytes of the instruction starting with 'opcode', without printing it
+int e8080_instruction_size(unsigned char opcode);
+
+#endif
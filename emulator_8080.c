@@ -1,97 +1,220 @@
+#define _GNU_SOURCE        // memfd_create
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-
-struct ConditionFlags {
-	uint8_t z:1;    // zero
-	uint8_t s:1;    // sign
-	uint8_t p:1;    // parity
-	uint8_t cy:1;   // carry
-	uint8_t ac:1;   // auxiliary carry
-	uint8_t pad:3;  // padding; this makes the struct 8 bit long
-};
-
-struct State8080 {
-	uint8_t *memory;
-	uint8_t int_enable;
-	struct ConditionFlags cf;
-	uint8_t a;                  // accumulator
-	uint8_t b;
-	uint8_t c;
-	uint8_t d;
-	uint8_t e;
-	uint8_t f;
-	uint8_t h;
-	uint8_t l;
-	uint16_t sp;                // stack pointer
-	uint16_t pc;                // program counter
-};  // sizeof is 24 (2 bytes of padding)
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "emulator_8080.h"
+#include "helpers_8080.h"
+#include "invaders_8080.h"
+#include "frame_8080.h"
+#include "jit_8080.h"
+#include "replay_8080.h"
+#include "profile_8080.h"
+
+void materialize_flags(struct State8080 *state)
+{
+	uint8_t pending = state->lazy_pending;
+	if ( pending & LAZY_ZSP )
+	{
+		set_zsp(state, state->lazy_result & 0xff);
+	}
+	if ( pending & LAZY_CY )
+	{
+		state->cf.cy = (state->lazy_result >> 8) & 0x1;
+	}
+	if ( pending & LAZY_AC )
+	{
+		state->cf.ac = (state->lazy_aux >> 4) & 0x1;
+	}
+	state->lazy_pending = 0;
+}
 
 void unassigned_instruction(struct State8080 *state)
 {
 	// Needs to undo pc as it has already advanced
 	puts("Error: unassigned instruction");
-	printf("Instruction: 0x%04x", state->pc);
+	printf("Instruction: 0x%04x", state->pc - 1);
 	exit(EXIT_FAILURE);
 }
 
-uint16_t combine_two_8bit(uint8_t byte1, uint8_t byte2)
+uint8_t psw_8080(struct State8080 *state)
 {
-	return (byte2 << 8) | byte1;
+	materialize_flags(state);
+	return (state->cf.s << 7) | (state->cf.z << 6) | (state->cf.ac << 4) | (state->cf.p << 2) | 0x2 | state->cf.cy;
+}
+
+void trace_8080_record(struct State8080 *state)
+{
+	struct TraceEntry8080 *entry = trace_8080_next(state->trace);
+	memcpy(entry->code, &state->memory[state->pc], 3);
+	entry->pc = state->pc;
+	entry->psw = psw_8080(state);
+	entry->a = state->a;
+	entry->b = state->b;
+	entry->c = state->c;
+	entry->d = state->d;
+	entry->e = state->e;
+	entry->h = state->h;
+	entry->l = state->l;
+	entry->pad = 0;
+	entry->sp = state->sp;
+}
+
+// 7 bits per byte, low bits first, bit 7 set on all but the last byte;
+// returns the end of what was written
+static uint8_t *put_varint_8080(uint8_t *out, uint64_t value)
+{
+	while ( value >= 0x80 )
+	{
+		*out++ = value | 0x80;
+		value >>= 7;
+	}
+	*out++ = value;
+	return out;
+}
+
+static uint64_t get_varint_8080(const uint8_t **in)
+{
+	uint64_t value = 0;
+	for ( int shift = 0; ; shift += 7 )
+	{
+		uint8_t byte = *(*in)++;
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		if ( !(byte & 0x80) )
+		{
+			return value;
+		}
+	}
+}
+
+// Playback: the recorded value, if the next record is a read of this port
+// at this cycle
+static int replay_8080_play(struct Replay8080 *replay, uint8_t port, uint64_t cycles, uint8_t *value)
+{
+	const uint8_t *bytes = replay->bytes;
+	size_t at = replay->at;
+	uint64_t word = 0;
+	for ( int shift = 0; ; shift += 7 )
+	{
+		if ( at >= replay->size || shift > 63 )
+		{
+			return 0;
+		}
+		uint8_t byte = bytes[at++];
+		word |= (uint64_t)(byte & 0x7f) << shift;
+		if ( !(byte & 0x80) )
+		{
+			break;
+		}
+	}
+	if ( replay->cycles + (word >> 1) != cycles || at >= replay->size || bytes[at++] != port )
+	{
+		return 0;
+	}
+	if ( !(word & 1) )
+	{
+		if ( at >= replay->size )
+		{
+			return 0;
+		}
+		replay->last[port] = bytes[at++];
+	}
+	*value = replay->last[port];
+	replay->at = at;
+	replay->cycles = cycles;
+	replay->reads++;
+	return 1;
+}
+
+static void replay_8080_append(struct Replay8080 *replay, uint8_t port, uint64_t cycles, uint8_t value)
+{
+	// at most 10 bytes of varint, the port and the value
+	if ( replay->capacity - replay->size < 12 )
+	{
+		size_t capacity = replay->capacity ? replay->capacity * 2 : 65536;
+		uint8_t *bytes = realloc(replay->bytes, capacity);
+		if ( bytes == NULL )
+		{
+			puts("error: Could not grow the input log");
+			exit(1);
+		}
+		replay->bytes = bytes;
+		replay->capacity = capacity;
+	}
+	uint8_t *out = replay->bytes + replay->size;
+	uint8_t same = replay->last[port] == value;
+	out = put_varint_8080(out, (cycles - replay->cycles) << 1 | same);
+	*out++ = port;
+	if ( !same )
+	{
+		*out++ = value;
+	}
+	replay->size = out - replay->bytes;
+	replay->cycles = cycles;
+	replay->last[port] = value;
+	replay->reads++;
 }
 
-uint8_t byte_parity(uint8_t byte)
+uint8_t replay_8080_in(struct State8080 *state, uint8_t port, uint64_t cycles)
 {
-	uint8_t count = 0;
-	uint8_t sbyte = byte;
-	while( sbyte )
+	struct Replay8080 *replay = state->replay;
+	uint8_t value;
+	if ( replay->mode == REPLAY_8080_PLAY && !replay->diverged )
 	{
-		if((sbyte & 0x1) == 1)
+		if ( replay_8080_play(replay, port, cycles, &value) )
 		{
-			count++;
+			return value;
 		}
-		sbyte = sbyte >> 1;
+		// past the end of the log, or no longer the session it recorded
+		replay->diverged = 1;
+	}
+	value = state->ports != NULL ? state->ports->in[port](state->ports->ctx, port) : 0;
+	if ( replay->mode == REPLAY_8080_RECORD )
+	{
+		replay_8080_append(replay, port, cycles, value);
 	}
-	return count;
+	return value;
+}
+
+uint16_t combine_two_8bit(uint8_t byte1, uint8_t byte2)
+{
+	return (byte2 << 8) | byte1;
 }
 
 void add_8080(struct State8080 *state, uint8_t reg, uint8_t carry)
 {
 	// do the math with higher precision so we can capture the carry out
 	uint16_t result = (uint16_t)state->a + (uint16_t)reg;
-	uint8_t auxiliary = ((state->a) & 0xf) + (reg & 0xf);
 	if ( carry )
 	{
+		materialize_carry(state);
 		result += state->cf.cy;
-		auxiliary += state->cf.cy;
-	}
-	// relational operators are not garanteed to return 1 (?)
-	// does not matter since the flags are bit sized
-	state->cf.z = ((result & 0xff) == 0);
-	state->cf.cy = (result > 0xff);
-	state->cf.s = ((result & 0x80) != 0);
-	state->cf.p = byte_parity( result & 0xff );
-	state->cf.ac = (auxiliary > 0xf);
+	}
+	// bit 4 of a ^ reg ^ result is the carry out of the low nibble
+	state->lazy_result = result;
+	state->lazy_aux = state->a ^ reg ^ result;
+	state->lazy_pending = LAZY_ZSP | LAZY_CY | LAZY_AC;
 	state->a = result & 0xff;
 }
 
 void sub_8080(struct State8080 *state, uint8_t reg, uint8_t carry)
 {
-	// do the math with higher precision so we can capture the carry out
+	// do the math with higher precision so we can capture the borrow in bit 8
 	uint16_t result = (uint16_t)state->a - (uint16_t)reg;
-	uint8_t auxiliary = ((state->a) & 0xf) - (reg & 0xf);
 	if ( carry )
 	{
+		materialize_carry(state);
 		result -= state->cf.cy;
-		auxiliary -= state->cf.cy;
-	}
-	// relational operators are not garanteed to return 1 (?)
-	// does not matter since the flags are bit sized
-	state->cf.z = ((result & 0xff) == 0);
-	state->cf.cy = (result > 0xff);
-	state->cf.s = ((result & 0x80) != 0);
-	state->cf.p = byte_parity( result & 0xff );
-	state->cf.ac = (auxiliary > 0xf);
+	}
+	state->lazy_result = result & 0x1ff;
+	state->lazy_aux = state->a ^ reg ^ result;
+	state->lazy_pending = LAZY_ZSP | LAZY_CY | LAZY_AC;
 	state->a = result & 0xff;
 }
 
@@ -99,10 +222,10 @@ void inr_8080(struct State8080 *state, uint8_t *reg)
 {
 	uint8_t res = *reg;
 	res += 1;
-	state->cf.z = (res == 0);
-	state->cf.s = res >> 7;
-	state->cf.p = byte_parity( res );
-	state->cf.ac = ((*reg & 0xf) == 0xf);
+	materialize_carry(state); // CY is not affected
+	state->lazy_result = res;
+	state->lazy_aux = *reg ^ res;
+	state->lazy_pending = LAZY_ZSP | LAZY_AC;
 	*reg = res;
 }
 
@@ -110,10 +233,10 @@ void dcr_8080(struct State8080 *state, uint8_t *reg)
 {
 	uint8_t res = *reg;
 	res -= 1;
-	state->cf.z = (res == 0);
-	state->cf.s = res >> 7;
-	state->cf.p = byte_parity( res );
-	state->cf.ac = ((*reg & 0xf) == 0);
+	materialize_carry(state); // CY is not affected
+	state->lazy_result = res;
+	state->lazy_aux = *reg ^ res;
+	state->lazy_pending = LAZY_ZSP | LAZY_AC;
 	*reg = res;
 }
 
@@ -169,8 +292,8 @@ void dcx_8080(struct State8080 *state, uint8_t pair)
 		case 0x2:
 			pair_mem = combine_two_8bit(state->l, state->h);
 			pair_mem--;
-			state->h = pair_mem & 0xff;
-			state->l = (pair_mem >> 8) & 0xff;
+			state->l = pair_mem & 0xff;
+			state->h = (pair_mem >> 8) & 0xff;
 			break;
 		case 0x3:
 			state->sp--;
@@ -203,6 +326,7 @@ void dad_8080(struct State8080 *state, uint8_t pair)
 			break;
 	}
 	state->cf.cy = (res > 0xffff);
+	state->lazy_pending &= ~LAZY_CY;
 	state->l = (res & 0xff);
 	state->h = (res >> 8) & 0xff;
 }
@@ -210,58 +334,63 @@ void dad_8080(struct State8080 *state, uint8_t pair)
 void and_8080(struct State8080 *state, uint8_t reg)
 {
 	state->a &= reg;
-	state->cf.cy = 0;
-	state->cf.z = (state->a == 0);
-	state->cf.s = state->a >> 7;
-	state->cf.p = byte_parity(state->a);
+	state->lazy_result = state->a; // CY is cleared, AC is not affected
+	state->lazy_pending |= LAZY_ZSP | LAZY_CY;
 }
 
 void xor_8080(struct State8080 *state, uint8_t reg)
 {
 	state->a ^= reg;
-	state->cf.cy = 0;
-	state->cf.ac = 0;
-	state->cf.z = (state->a == 0);
-	state->cf.s = state->a >> 7;
-	state->cf.p = byte_parity(state->a);
+	state->lazy_result = state->a;
+	state->lazy_aux = 0;
+	state->lazy_pending = LAZY_ZSP | LAZY_CY | LAZY_AC;
 }
 
 void or_8080(struct State8080 *state, uint8_t reg)
 {
 	state->a |= reg;
-	state->cf.cy = 0;
-	state->cf.ac = 0;
-	state->cf.z = (state->a == 0);
-	state->cf.s = state->a >> 7;
-	state->cf.p = byte_parity(state->a);
+	state->lazy_result = state->a;
+	state->lazy_aux = 0;
+	state->lazy_pending = LAZY_ZSP | LAZY_CY | LAZY_AC;
 }
 
 void cmp_8080(struct State8080 *state, uint8_t reg)
 {
-	uint8_t tmp = state->a - reg;
-	state->cf.cy = (state->a < reg);
-	state->cf.z = (state->a == reg);
-	state->cf.s = (tmp == 0);
-	state->cf.p = byte_parity(tmp);
-	state->cf.ac = ((state->a & 0xf) < (reg & 0xf));
+	uint16_t tmp = (uint16_t)state->a - (uint16_t)reg;
+	state->lazy_result = tmp & 0x1ff;
+	state->lazy_aux = state->a ^ reg ^ tmp;
+	state->lazy_pending = LAZY_ZSP | LAZY_CY | LAZY_AC;
 }
 
-void jmp_8080(struct State8080 *state, uint8_t byte1, uint8_t byte2, uint8_t cond)
+void write_8080(struct State8080 *state, uint16_t addr, uint8_t value)
 {
-	uint8_t test;
+	store_8080(state, addr, value);
+}
+
+// Evaluates the condition encoded in bits 3-5 of Jcc/Ccc/Rcc; 8 means always
+uint8_t condition_8080(struct State8080 *state, uint8_t cond)
+{
+	if ( cond > 7 )
+	{
+		return 1;
+	}
+	materialize_flags(state);
 	switch (cond)
 	{
-		case 0: test = (state->cf.z == 0); break;
-		case 1: test = state->cf.z; break;
-		case 2: test = (state->cf.cy == 0); break;
-		case 3: test = state->cf.cy; break;
-		case 4: test = (state->cf.p == 0); break;
-		case 5: test = state->cf.p; break;
-		case 6: test = (state->cf.s == 0); break;
-		case 7: test = state->cf.s; break;
-		default: test = 1; break;
+		case 0: return (state->cf.z == 0);
+		case 1: return state->cf.z;
+		case 2: return (state->cf.cy == 0);
+		case 3: return state->cf.cy;
+		case 4: return (state->cf.p == 0);
+		case 5: return state->cf.p;
+		case 6: return (state->cf.s == 0);
+		default: return state->cf.s;
 	}
-	if (test)
+}
+
+void jmp_8080(struct State8080 *state, uint8_t byte1, uint8_t byte2, uint8_t cond)
+{
+	if ( condition_8080(state, cond) )
 	{
 		state->pc = combine_two_8bit(byte1, byte2);
 	}
@@ -271,1083 +400,1153 @@ void jmp_8080(struct State8080 *state, uint8_t byte1, uint8_t byte2, uint8_t con
 	}
 }
 
-void call_8080(struct State8080 *state, uint8_t byte1, uint8_t byte2, uint8_t cond)
+uint8_t call_8080(struct State8080 *state, uint8_t byte1, uint8_t byte2, uint8_t cond)
 {
-	uint8_t test;
-	switch (cond)
-	{
-		case 0: test = (state->cf.z == 0); break;
-		case 1: test = state->cf.z; break;
-		case 2: test = (state->cf.cy == 0); break;
-		case 3: test = state->cf.cy; break;
-		case 4: test = (state->cf.p == 0); break;
-		case 5: test = state->cf.p; break;
-		case 6: test = (state->cf.s == 0); break;
-		case 7: test = state->cf.s; break;
-		default: test = 1; break;
-	}
-	if (test)
+	if ( condition_8080(state, cond) )
 	{
 		state->pc += 2; // ret
-		state->memory[state->sp - 1] = state->pc >> 8;
-		state->memory[state->sp - 2] = state->pc & 0xff;
+		store_8080(state, (uint16_t)(state->sp - 1), state->pc >> 8);
+		store_8080(state, (uint16_t)(state->sp - 2), state->pc & 0xff);
 		state->sp -= 2;
 		state->pc = combine_two_8bit(byte1, byte2);
+		return 1;
 	}
-	else
-	{
-		state->pc += 2;
-	}
+	state->pc += 2;
+	return 0;
 }
 
-void ret_8080(struct State8080 *state, uint8_t cond)
+uint8_t ret_8080(struct State8080 *state, uint8_t cond)
 {
-	uint8_t test;
-	switch (cond)
-	{
-		case 0: test = (state->cf.z == 0); break;
-		case 1: test = state->cf.z; break;
-		case 2: test = (state->cf.cy == 0); break;
-		case 3: test = state->cf.cy; break;
-		case 4: test = (state->cf.p == 0); break;
-		case 5: test = state->cf.p; break;
-		case 6: test = (state->cf.s == 0); break;
-		case 7: test = state->cf.s; break;
-		default: test = 1; break;
-	}
-	if (test)
+	if ( condition_8080(state, cond) )
 	{
-		state->pc = combine_two_8bit(state->memory[state->sp], state->memory[state->sp + 1]);
+		state->pc = combine_two_8bit(state->memory[state->sp], state->memory[(uint16_t)(state->sp + 1)]);
 		state->sp += 2;
+		return 1;
 	}
+	return 0;
 }
 
 void rst_8080(struct State8080 *state, uint8_t nnn)
 {
-	state->pc++;
-	state->memory[state->sp - 1] = state->pc >> 8;
-	state->memory[state->sp - 2] = state->pc & 0xff;
+	store_8080(state, (uint16_t)(state->sp - 1), state->pc >> 8);
+	store_8080(state, (uint16_t)(state->sp - 2), state->pc & 0xff);
 	state->sp -= 2;
 	state->pc = (uint16_t)(nnn << 3);
 }
 
+const uint8_t cycles_8080[256] = {
+	 4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4,  // 0x00
+	 4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4,  // 0x10
+	 4, 10, 16,  5,  5,  5,  7,  4,  4, 10, 16,  5,  5,  5,  7,  4,  // 0x20
+	 4, 10, 13,  5, 10, 10, 10,  4,  4, 10, 13,  5,  5,  5,  7,  4,  // 0x30
+	 5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,  // 0x40
+	 5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,  // 0x50
+	 5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,  // 0x60
+	 7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5,  // 0x70
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 0x80
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 0x90
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 0xa0
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,  // 0xb0
+	 5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11,  // 0xc0
+	 5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11,  // 0xd0
+	 5, 10, 10, 18, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11,  // 0xe0
+	 5, 10, 10,  4, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11,  // 0xf0
+};
+
 int emulate_8080(struct State8080 *state)
 {
 	uint8_t *state_mem = state->memory;
 	unsigned char *opcode = &state_mem[state->pc];	// '->' has higher precedence than '&'
-	printf("opcode:\t0x%02x", *opcode);
+	uint8_t executed = *opcode; // the instruction may overwrite itself
+	int cycles = cycles_8080[*opcode];
+	if ( state->trace )
+	{
+		trace_8080_record(state);
+	}
+	state->pc++;
 	switch (*opcode)
 	{
-		// MOV r1,r2
-		case 0x40:
-			break;
-		case 0x41:
-			state->b = state->c;
-			break;
-		case 0x42:
-			state->b = state->d;
-			break;
-		case 0x43:
-			state->b = state->e;
-			break;
-		case 0x44:
-			state->b = state->h;
-			break;
-		case 0x45:
-			state->b = state->l;
-			break;
-		case 0x47:
-			state->b = state->a;
-		   break;
-		case 0x48:
-			state->c = state->b;
-	 		break;
-		case 0x49:
-			break;
-		case 0x4a:
-			state->c = state->d;
-			break;
-		case 0x4b:
-			state->c = state->e;
-			break;
-		case 0x4c:
-			state->c = state->h;
-			break;
-		case 0x4d:
-			state->c = state->l;
-			break;
-		case 0x4f:
-			state->c = state->a;
-			break;
-		case 0x50:
-			state->d = state->b;
-			break;
-		case 0x51:
-			state->d = state->c;
-			break;
-		case 0x52:
-			break;
-		case 0x53:
-			state->d = state->e;
-			break;
-		case 0x54:
-			state->d = state->h;
-			break;
-		case 0x55:
-			state->d = state->l;
-		case 0x57:
-			state->d = state->a;
-			break;
-		case 0x58:
-			state->e = state->b;
-			break;
-		case 0x59:
-			state->e = state->c;
-			break;
-		case 0x5a:
-			state->e = state->d;
-			break;
-		case 0x5b:
-			break;
-		case 0x5c:
-			state->e = state->h;
-			break;
-		case 0x5d:
-			state->e = state->l;
-			break;
-		case 0x5f:
-			state->e = state->a;
-			break;
-		case 0x60:
-			state->h = state->b;
-			break;
-		case 0x61:
-			state->h = state->c;
-			break;
-		case 0x62:
-			state->h = state->d;
-			break;
-		case 0x63:
-			state->h = state->e;
-			break;
-		case 0x64:
-			break;
-		case 0x65:
-			state->h = state->l;
-			break;
-		case 0x67:
-			state->h = state->a;
-			break;
-		case 0x68:
-			state->l = state->b;
-			break;
-		case 0x69:
-			state->l = state->c;
-			break;
-		case 0x6a:
-			state->l = state->d;
-			break;
-		case 0x6b:
-			state->l = state->e;
-			break;
-		case 0x6c:
-			state->l = state->h;
-			break;
-		case 0x6d:
-			break;
-		case 0x6f:
-			state->l = state->a;
-			break;
-		case 0x78:
-			state->a = state->b;
-			break;
-		case 0x79:
-			state->a = state->c;
-			break;
-		case 0x7a:
-			state->a = state->d;
-			break;
-		case 0x7b:
-			state->a = state->e;
-			break;
-		case 0x7c:
-			state->a = state->h;
-			break;
-		case 0x7d:
-			state->a = state->l;
-			break;
-		case 0x7f:
-			break;
-		
-		// MOV r,M
-		case 0x46:
-			state->b = state_mem[combine_two_8bit(state->l, state->h)];
-			break;	
-		case 0x4e:
-			state->c = state_mem[combine_two_8bit(state->l, state->h)];
-			break;
-		case 0x56:
-			state->d = state_mem[combine_two_8bit(state->l, state->h)];
-			break;
-		case 0x5e:
-			state->e = state_mem[combine_two_8bit(state->l, state->h)];
-			break;
-		case 0x66:
-			state->h = state_mem[combine_two_8bit(state->l, state->h)];
-			break;
-		case 0x6e:
-			state->l = state_mem[combine_two_8bit(state->l, state->h)];
-			break;
-		case 0x7e:
-			state->a = state_mem[combine_two_8bit(state->l, state->h)];
-			break;
-		
-		// MOV M,r
-		case 0x70:
-			state_mem[combine_two_8bit(state->l, state->h)] = state->b;
-			break;
-		case 0x71:
-			state_mem[combine_two_8bit(state->l, state->h)] = state->c;
-			break;
-		case 0x72:
-			state_mem[combine_two_8bit(state->l, state->h)] = state->d;
-			break;
-		case 0x73:
-			state_mem[combine_two_8bit(state->l, state->h)] = state->e;
-			break;
-		case 0x74:
-			state_mem[combine_two_8bit(state->l, state->h)] = state->h;
-			break;
-		case 0x75:
-			state_mem[combine_two_8bit(state->l, state->h)] = state->l;
-			break;
-		case 0x77:
-			state_mem[combine_two_8bit(state->l, state->h)] = state->a;
-			break;
+#define ELAPSED_8080 0
+#define OPCODE(op, ...) case op: __VA_ARGS__ break;
+#include "opcodes_8080.h"
+#undef OPCODE
+#undef ELAPSED_8080
+	}
+	state->cycles += cycles;
+	if ( state->profile )
+	{
+		profile_8080_count(state->profile, state, opcode - state_mem, executed, cycles);
+	}
+	return cycles;
+}
 
-		// MVI r,data
-		case 0x06:
-			state->b = opcode[1];
-			state->pc++;
-			break;
-		case 0x0e:
-			state->c = opcode[1];
-			state->pc++;
-			break;
-		case 0x16:
-			state->d = opcode[1];
-			state->pc++;
-			break;
-		case 0x1e:
-			state->e = opcode[1];
-			state->pc++;
-			break;
-		case 0x26:
-			state->h = opcode[1];
-			state->pc++;
-			break;
-		case 0x2e:
-			state->l = opcode[1];
-			state->pc++;
-			break;
-		case 0x3e:
-			state->a = opcode[1];
-			state->pc++;
-			break;
+#if defined(__GNUC__)
+// While profiling, the fast loops hand over to this one
+static int run_profiled_8080(struct State8080 *state, int budget)
+{
+	int cycles = 0;
+	while ( cycles < budget )
+	{
+		cycles += emulate_8080(state);
+	}
+	return cycles;
+}
 
-		// MVI M,data
-		case 0x36:	
-			state_mem[combine_two_8bit(state->l, state->h)] = opcode[1];
-			state->pc++;
-			break;
+/*
+ * Direct-threaded interpreter: every handler ends with its own copy of
+ * DISPATCH, which jumps straight to the handler of the next opcode through
+ * a table of label addresses (a GCC extension), so each instruction gets
+ * its own indirect branch for the predictor to learn.
+ */
+int run_for_cycles_8080(struct State8080 *state, int budget)
+{
+	static const void *const dispatch[256] = {
+#define OPCODE(op, ...) [op] = &&op_##op,
+#include "opcodes_8080.h"
+#undef OPCODE
+	};
+	if ( state->profile )
+	{
+		return run_profiled_8080(state, budget);
+	}
+	uint8_t *state_mem = state->memory;
+	unsigned char *opcode;
+	int cycles = 0;
+
+#define DISPATCH() \
+	do \
+	{ \
+		if ( cycles >= budget ) \
+		{ \
+			state->cycles += cycles; \
+			return cycles; \
+		} \
+		if ( state->trace ) \
+		{ \
+			trace_8080_record(state); \
+		} \
+		opcode = &state_mem[state->pc]; \
+		state->pc++; \
+		cycles += cycles_8080[*opcode]; \
+		goto *dispatch[*opcode]; \
+	} while (0)
+
+	DISPATCH();
+#define ELAPSED_8080 (cycles - cycles_8080[*opcode])
+#define OPCODE(op, ...) op_##op: __VA_ARGS__ DISPATCH();
+#include "opcodes_8080.h"
+#undef OPCODE
+#undef ELAPSED_8080
+#undef DISPATCH
+}
 
-		// LXI rp,data16
-		case 0x01:
-			state->b = opcode[2];
-			state->c = opcode[1];
-			state->pc+=2;			// advance PC to the end of instruction
-			break;
-		case 0x11:
-			state->d = opcode[2];
-			state->e = opcode[1];
-			state->pc+=2;
-			break;
-		case 0x21:
-			state->h = opcode[2];
-			state->l = opcode[1];
-			state->pc+=2;
-		case 0x31:
-			state->sp = combine_two_8bit(opcode[1], opcode[2]);
-			state->pc+=2;
+/*
+ * The same loop fetching from state->decode: one 8-byte load gives the
+ * handler, the cycles and the operands, instead of reading the opcode from
+ * memory and looking it up in two tables. Bodies get 'opcode' pointing into
+ * the entry. Handlers are stored as offsets from the decode label, another
+ * GCC extension, which keeps entries small and makes an empty (zeroed)
+ * entry jump straight to the decoder.
+ *
+ * An ALU instruction followed by a conditional jump on its result, as in
+ * FUSED_PAIRS_8080, is decoded to a handler that runs both: the jump's
+ * condition is read straight off the result instead of materializing the
+ * flags (they stay lazy, so PUSH PSW still sees the same values), and the
+ * second dispatch is skipped. The jump still comes from its own entry and
+ * is only taken there when that entry holds the expected opcode and the
+ * budget and trace checks of a normal dispatch pass; otherwise it is
+ * dispatched as usual, so the instructions run and the cycles counted are
+ * those of running the two one after the other.
+ */
+// FUSE(opcode, its length, Jcc opcode, condition of the jump after it)
+#define FUSED_PAIRS_8080 \
+	FUSE(0x05, 1, 0xc2, state->b != 0)             /* DCR B; JNZ */ \
+	FUSE(0x0d, 1, 0xc2, state->c != 0)             /* DCR C; JNZ */ \
+	FUSE(0x15, 1, 0xc2, state->d != 0)             /* DCR D; JNZ */ \
+	FUSE(0x1d, 1, 0xc2, state->e != 0)             /* DCR E; JNZ */ \
+	FUSE(0x3d, 1, 0xc2, state->a != 0)             /* DCR A; JNZ */ \
+	FUSE(0xa7, 1, 0xc2, state->a != 0)             /* ANA A; JNZ */ \
+	FUSE(0xa7, 1, 0xca, state->a == 0)             /* ANA A; JZ */ \
+	FUSE(0xb7, 1, 0xc2, state->a != 0)             /* ORA A; JNZ */ \
+	FUSE(0xb7, 1, 0xca, state->a == 0)             /* ORA A; JZ */ \
+	FUSE(0xfe, 2, 0xc2, state->a != opcode[1])     /* CPI; JNZ */ \
+	FUSE(0xfe, 2, 0xca, state->a == opcode[1])     /* CPI; JZ */ \
+	FUSE(0xfe, 2, 0xd2, state->a >= opcode[1])     /* CPI; JNC */ \
+	FUSE(0xfe, 2, 0xda, state->a < opcode[1])      /* CPI; JC */
+
+int run_predecoded_8080(struct State8080 *state, int budget)
+{
+	static const int32_t handlers[256] = {
+#define OPCODE(op, ...) [op] = &&op_##op - &&decode,
+#include "opcodes_8080.h"
+#undef OPCODE
+	};
+	static const struct {
+		uint8_t first;
+		uint8_t length;
+		uint8_t second;
+		int32_t handler;
+	} fused[] = {
+#define FUSE(first, length, second, condition) { first, length, second, &&fused_##first##_##second - &&decode },
+		FUSED_PAIRS_8080
+#undef FUSE
+	};
+	if ( state->profile )
+	{
+		return run_profiled_8080(state, budget);
+	}
+	uint8_t *state_mem = state->memory;
+	struct DecodedOp8080 *ops = state->decode->ops;
+	struct DecodedOp8080 *entry;
+	const unsigned char *opcode;
+	int cycles = 0;
+
+#define DISPATCH() \
+	do \
+	{ \
+		if ( cycles >= budget ) \
+		{ \
+			state->cycles += cycles; \
+			return cycles; \
+		} \
+		if ( state->trace ) \
+		{ \
+			trace_8080_record(state); \
+		} \
+		entry = &ops[state->pc]; \
+		opcode = entry->code; \
+		state->pc++; \
+		cycles += entry->cycles; \
+		goto *(&&decode + entry->handler); \
+	} while (0)
+
+	DISPATCH();
+decode:
+	// the padding after guest memory makes the operand bytes at $fffe-$ffff readable
+	memcpy(entry->code, &state_mem[(uint16_t)(state->pc - 1)], 3);
+	entry->handler = handlers[entry->code[0]];
+	entry->cycles = cycles_8080[entry->code[0]];
+	for ( int i = 0; i < (int)(sizeof(fused) / sizeof(fused[0])); i++ )
+	{
+		if ( fused[i].first == entry->code[0] && fused[i].second == state_mem[(uint16_t)(state->pc - 1 + fused[i].length)] )
+		{
+			entry->handler = fused[i].handler;
 			break;
+		}
+	}
+	cycles += entry->cycles;
+	goto *(&&decode + entry->handler);
+#define ELAPSED_8080 (cycles - entry->cycles)
+#define OPCODE(op, ...) op_##op: __VA_ARGS__ DISPATCH();
+#include "opcodes_8080.h"
+#undef OPCODE
+#undef ELAPSED_8080
+#define FUSE(first, length, second, condition) \
+fused_##first##_##second: \
+	cycles += body_##first(state, state_mem, opcode, cycles - entry->cycles); \
+	if ( cycles < budget && !state->trace && (entry = &ops[state->pc])->handler == handlers[second] ) \
+	{ \
+		cycles += entry->cycles; \
+		state->pc = (condition) ? combine_two_8bit(entry->code[1], entry->code[2]) : state->pc + 3; \
+	} \
+	DISPATCH();
+	FUSED_PAIRS_8080
+#undef FUSE
+#undef DISPATCH
+}
+#else
+// Portable fallback for compilers without labels as values
+int run_for_cycles_8080(struct State8080 *state, int budget)
+{
+	int cycles = 0;
+	while ( cycles < budget )
+	{
+		cycles += emulate_8080(state);
+	}
+	return cycles;
+}
 
-		// LDA addr
-		case 0x3a:
-			state->a = state_mem[combine_two_8bit(opcode[1], opcode[2])];
-			state->pc += 2;
-			break;
+int run_predecoded_8080(struct State8080 *state, int budget)
+{
+	return run_for_cycles_8080(state, budget);
+}
+#endif
 
-		// STA addr
-		case 0x32:
-			state_mem[combine_two_8bit(opcode[1], opcode[2])] = state->a;
-			state->pc += 2;
-			break;
+int interrupt_8080(struct State8080 *state, uint8_t nnn)
+{
+	if ( !state->int_enable )
+	{
+		return 0;
+	}
+	// pc already holds the address of the next instruction, which is what RST pushes
+	state->int_enable = 0;
+	rst_8080(state, nnn);
+	state->cycles += cycles_8080[0xc7];
+	if ( state->profile )
+	{
+		profile_8080_enter(state->profile, nnn << 3, state->sp);
+		state->profile->tree[state->profile->node].cycles += cycles_8080[0xc7];
+	}
+	return 1;
+}
 
-		// LHLD addr
-		case 0x2a:
-			state->l = state_mem[combine_two_8bit(opcode[1], opcode[2])];
-			state->h = state_mem[combine_two_8bit(opcode[1], opcode[2]) + 1];
-			state->pc += 2;
-			break;
+void initialize_scheduler(struct Scheduler8080 *scheduler)
+{
+	scheduler->run = run_for_cycles_8080;
+	scheduler->count = 0;
+}
 
-		// SHLD addr
-		case 0x22:
-			state_mem[combine_two_8bit(opcode[1], opcode[2])] = state->l;
-			state_mem[combine_two_8bit(opcode[1], opcode[2]) + 1] = state->h;
-			state->pc += 2;
-			break;
+int schedule_event_8080(struct Scheduler8080 *scheduler, uint64_t when, void (*fire)(struct State8080 *state, void *ctx), void *ctx)
+{
+	if ( scheduler->count == MAX_EVENTS_8080 )
+	{
+		return -1;
+	}
+	// insertion sort; events due at the same cycle fire in the order they were scheduled
+	int i = scheduler->count++;
+	while ( i > 0 && scheduler->events[i - 1].when > when )
+	{
+		scheduler->events[i] = scheduler->events[i - 1];
+		i--;
+	}
+	scheduler->events[i].when = when;
+	scheduler->events[i].fire = fire;
+	scheduler->events[i].ctx = ctx;
+	return 0;
+}
 
-		// LDAX rp
-		case 0x0a:
-			state->a = state_mem[combine_two_8bit(state->c, state->b)];
-			break;
-		case 0x1a:
-			state->a = state_mem[combine_two_8bit(state->e, state->d)];
-			break;			
+int run_scheduled_8080(struct State8080 *state, struct Scheduler8080 *scheduler, int budget)
+{
+	uint64_t start = state->cycles;
+	uint64_t end = start + budget;
+	while ( state->cycles < end )
+	{
+		uint64_t until = end;
+		if ( scheduler->count > 0 && scheduler->events[0].when < until )
+		{
+			until = scheduler->events[0].when;
+		}
+		if ( state->cycles < until )
+		{
+			scheduler->run(state, until - state->cycles);
+		}
+		// fire everything that is due; an event may schedule itself again
+		while ( scheduler->count > 0 && scheduler->events[0].when <= state->cycles )
+		{
+			struct Event8080 event = scheduler->events[0];
+			scheduler->count--;
+			memmove(&scheduler->events[0], &scheduler->events[1], scheduler->count * sizeof(struct Event8080));
+			event.fire(state, event.ctx);
+		}
+	}
+	return state->cycles - start;
+}
 
-		// XCHG
-		case 0xeb:
-			{
-				uint8_t tmp1, tmp2;
-				tmp1 = state->h;
-				tmp2 = state->l;
-				state->h = state->d;
-				state->l = state->e;
-				state->d = tmp1;
-				state->e = tmp2;
-			}
-			break;
+void initialize_state(struct State8080 *state, uint16_t pc, uint8_t *buffer)
+{
+	state->pc = pc;
+	state->cycles = 0;
+	state->cf.ac = 0;
+	state->cf.cy = 0;
+	state->cf.p = 0;
+	state->cf.s = 0;
+	state->cf.z = 0;
+	state->lazy_result = 0;
+	state->lazy_aux = 0;
+	state->lazy_pending = 0;
+	state->a = 0;
+	state->b = 0;
+	state->c = 0;
+	state->d = 0;
+	state->e = 0;
+	state->h = 0;
+	state->l = 0;
+	state->int_enable = 0;
+	state->sp = 0;
+	state->memory = buffer;
+	state->trace = NULL;
+	state->profile = NULL;
+	state->ports = NULL;
+	state->dirty = NULL;
+	state->watch = NULL;
+	state->decode = NULL;
+	state->jit = NULL;
+	state->replay = NULL;
+	state->recompiled = 0;
+}
 
-		// ADD r
-		case 0x80:
-			add_8080(state, state->b, 0);
-			break;
-		case 0x81:
-			add_8080(state, state->c, 0);
-			break;
-		case 0x82:
-			add_8080(state, state->d, 0);
-			break;
-		case 0x83:
-			add_8080(state, state->e, 0);
-			break;
-		case 0x84:
-			add_8080(state, state->h, 0);
-			break;
-		case 0x85:
-			add_8080(state, state->l, 0);
-			break;
-		case 0x87:
-			add_8080(state, state->a, 0);
-			break;
-
-		// ADD M
-		case 0x86:
-			add_8080(state, state_mem[combine_two_8bit(state->l, state->h)], 0);
-			break;
-
-		// ADI data
-		case 0xc6:
-			add_8080(state, opcode[1], 0);
-			state->pc++;
-			break;
-
-		// ADC r
-		case 0x88:
-			add_8080(state, state->b, 1);
-			break;
-		case 0x89:
-			add_8080(state, state->c, 1);
-			break;
-		case 0x8a:
-			add_8080(state, state->d, 1);
-			break;
-		case 0x8b:
-			add_8080(state, state->e, 1);
-			break;
-		case 0x8c:
-			add_8080(state, state->h, 1);
-			break;
-		case 0x8d:
-			add_8080(state, state->l, 1);
-			break;
-		case 0x8f:
-			add_8080(state, state->a, 1);
-			break;
-
-		// ADC M
-		case 0x8e:
-			add_8080(state, state_mem[combine_two_8bit(state->l, state->h)], 1);
-			break;
-
-		// ACI data
-		case 0xce:
-			add_8080(state, opcode[1], 1);
-			state->pc++;
-			break;
-
-		// SUB r
-		case 0x90:
-			sub_8080(state, state->b, 0);
-			break;
-		case 0x91:
-			sub_8080(state, state->c, 0);
-			break;
-		case 0x92:
-			sub_8080(state, state->d, 0);
-			break;
-		case 0x93:
-			sub_8080(state, state->e, 0);
-			break;
-		case 0x94:
-			sub_8080(state, state->h, 0);
-			break;
-		case 0x95:
-			sub_8080(state, state->l, 0);
-			break;
-		case 0x97:
-			sub_8080(state, state->a, 0);
-			break;
-
-		// SUB M
-		case 0x96:
-			sub_8080(state, state_mem[combine_two_8bit(state->l, state->h)], 0);
-			break;
-
-		// SUI data
-		case 0xd6:
-			sub_8080(state, opcode[1], 0);
-			state->pc++;
-			break;
-
-		// SBB r
-		case 0x98:
-			sub_8080(state, state->b, 1);
-			break;
-		case 0x99:
-			sub_8080(state, state->c, 1);
-			break;
-		case 0x9a:
-			sub_8080(state, state->d, 1);
-			break;
-		case 0x9b:
-			sub_8080(state, state->e, 1);
-			break;
-		case 0x9c:
-			sub_8080(state, state->h, 1);
-			break;
-		case 0x9d:
-			sub_8080(state, state->l, 1);
-			break;
-		case 0x9f:
-			sub_8080(state, state->a, 1);
-			break;
-
-		// SBB M
-		case 0x9e:
-			sub_8080(state, state_mem[combine_two_8bit(state->l, state->h)], 1);
-			break;
+uint8_t unconnected_in(void *ctx, uint8_t port)
+{
+	return 0;
+}
 
-		// SBI data
-		case 0xde:
-			sub_8080(state, opcode[1], 1);
-			state->pc++;
-			break;
+void unconnected_out(void *ctx, uint8_t port, uint8_t value)
+{
+}
 
-		// INR r
-		case 0x04:
-			inr_8080(state, &state->b);
-			break;
-		case 0x0c:
-			inr_8080(state, &state->c);
-			break;
-		case 0x14:
-			inr_8080(state, &state->d);
-			break;
-		case 0x1c:
-			inr_8080(state, &state->e);
-			break;
-		case 0x24:
-			inr_8080(state, &state->h);
-			break;
-		case 0x2c:
-			inr_8080(state, &state->l);
-			break;
-		case 0x3c:
-			inr_8080(state, &state->a);
-			break;
+// Starts with every line marked, so the first user converts everything
+void initialize_dirty(struct Dirty8080 *dirty, uint16_t base, uint16_t size, uint8_t shift)
+{
+	dirty->base = base;
+	dirty->size = size;
+	dirty->shift = shift;
+	memset(dirty->lines, 0xff, sizeof(dirty->lines));
+}
 
-		// INR M
-		case 0x34:
-			inr_8080(state, &state_mem[combine_two_8bit(state->l, state->h)]);
-			break;
+void clear_dirty(struct Dirty8080 *dirty)
+{
+	memset(dirty->lines, 0, sizeof(dirty->lines));
+}
 
-		// DCR r
-		case 0x05:
-			dcr_8080(state, &state->b);
-			break;
-		case 0x0d:
-			dcr_8080(state, &state->c);
-			break;
-		case 0x15:
-			dcr_8080(state, &state->d);
-			break;
-		case 0x1d:
-			dcr_8080(state, &state->e);
-			break;
-		case 0x25:
-			dcr_8080(state, &state->h);
-			break;
-		case 0x2d:
-			dcr_8080(state, &state->l);
-			break;
-		case 0x3d:
-			dcr_8080(state, &state->a);
-			break;
+void initialize_decode(struct Decode8080 *decode)
+{
+	memset(decode->ops, 0, sizeof(decode->ops));
+}
 
-		// DCR M
-		case 0x35:
-			dcr_8080(state, &state_mem[combine_two_8bit(state->l, state->h)]);
-			break;
+void initialize_ports(struct Ports8080 *ports, void *ctx)
+{
+	for ( int port = 0; port < 256; port++ )
+	{
+		ports->in[port] = unconnected_in;
+		ports->out[port] = unconnected_out;
+	}
+	ports->ctx = ctx;
+}
 
-		// INX r
-		case 0x03:
-			inx_8080(state, 0);
-			break;
-		case 0x13:
-			inx_8080(state, 1);
-			break;
-		case 0x23:
-			inx_8080(state, 2);
-			break;
-		case 0x33:
-			inx_8080(state, 3);
-			break;
+void put_le_8080(uint8_t *buffer, uint64_t value, int bytes)
+{
+	for ( int i = 0; i < bytes; i++ )
+	{
+		buffer[i] = value >> (8 * i);
+	}
+}
 
-		// DCX r
-		case 0x0b:
-			dcx_8080(state, 0);
-			break;
-		case 0x1b:
-			dcx_8080(state, 1);
-			break;
-		case 0x2b:
-			dcx_8080(state, 2);
-			break;
-		case 0x3b:
-			dcx_8080(state, 3);
-			break;
+uint64_t get_le_8080(const uint8_t *buffer, int bytes)
+{
+	uint64_t value = 0;
+	for ( int i = 0; i < bytes; i++ )
+	{
+		value |= (uint64_t)buffer[i] << (8 * i);
+	}
+	return value;
+}
 
-		// DAD rp
-		case 0x09:
-			dad_8080(state, 0);
-			break;
-		case 0x19:
-			dad_8080(state, 1);
-			break;
-		case 0x29:
-			dad_8080(state, 2);
-			break;
-		case 0x39:
-			dad_8080(state, 3);
-			break;
+int snapshot_8080(struct State8080 *state, uint8_t *buffer, int size)
+{
+	if ( size < SNAPSHOT_8080_SIZE )
+	{
+		return -1;
+	}
+	memcpy(buffer, "8080", 4);
+	buffer[4] = SNAPSHOT_8080_VERSION;
+	buffer[5] = state->a;
+	buffer[6] = state->b;
+	buffer[7] = state->c;
+	buffer[8] = state->d;
+	buffer[9] = state->e;
+	buffer[10] = state->h;
+	buffer[11] = state->l;
+	buffer[12] = psw_8080(state);
+	buffer[13] = state->int_enable;
+	put_le_8080(&buffer[14], state->sp, 2);
+	put_le_8080(&buffer[16], state->pc, 2);
+	put_le_8080(&buffer[18], state->cycles, 8);
+	memcpy(&buffer[SNAPSHOT_8080_HEADER], state->memory, MEMORY_SIZE_8080);
+	return SNAPSHOT_8080_SIZE;
+}
 
-		// DAA
-		case 0x27:
-			if ( ((state->a & 0xf) > 9) || state->cf.ac)
-			{
-				state->cf.ac = 1;
-				state->a += 6;
-			}
-			else
-			{
-				state->cf.ac = 0;
-			}
-			
-			if ( ((state->a  & 0xf0) > 0x90) || state->cf.cy)
+int restore_8080(struct State8080 *state, const uint8_t *buffer, int size)
+{
+	if ( size < SNAPSHOT_8080_SIZE || memcmp(buffer, "8080", 4) != 0 || buffer[4] != SNAPSHOT_8080_VERSION )
+	{
+		return -1;
+	}
+	state->a = buffer[5];
+	state->b = buffer[6];
+	state->c = buffer[7];
+	state->d = buffer[8];
+	state->e = buffer[9];
+	state->h = buffer[10];
+	state->l = buffer[11];
+	uint8_t psw = buffer[12];
+	state->cf.cy = psw & 0x1;
+	state->cf.p = (psw >> 2) & 0x1;
+	state->cf.ac = (psw >> 4) & 0x1;
+	state->cf.z = (psw >> 6) & 0x1;
+	state->cf.s = (psw >> 7) & 0x1;
+	state->lazy_pending = 0;
+	state->int_enable = buffer[13];
+	state->sp = get_le_8080(&buffer[14], 2);
+	state->pc = get_le_8080(&buffer[16], 2);
+	state->cycles = get_le_8080(&buffer[18], 8);
+	state->recompiled = 0;
+
+	// a run that forked from this snapshot usually changed a few pages, so
+	// only those are written
+	const uint8_t *memory = &buffer[SNAPSHOT_8080_HEADER];
+	for ( int page = 0; page < MEMORY_SIZE_8080; page += 1 << WATCH_8080_PAGE_SHIFT )
+	{
+		if ( memcmp(&state->memory[page], &memory[page], 1 << WATCH_8080_PAGE_SHIFT) == 0 )
+		{
+			continue;
+		}
+		for ( int addr = page; addr < page + (1 << WATCH_8080_PAGE_SHIFT); addr++ )
+		{
+			if ( state->memory[addr] != memory[addr] )
 			{
-				state->cf.cy = 1;
-				state->a = ((state->a & 0xf0) + 0x60) | (state->a & 0xf);
+				store_8080(state, addr, memory[addr]);
 			}
-			state->cf.s = state->a >> 7;
-			state->cf.p = byte_parity( state->a );
-			state->cf.z = (state->a == 0);
-			break;
-
-		// ANA r
-		case 0xa0:
-			and_8080(state, state->b);
-			break;
-		case 0xa1:
-			and_8080(state, state->c);
-			break;
-		case 0xa2:
-			and_8080(state, state->d);
-			break;
-		case 0xa3:
-			and_8080(state, state->e);
-			break;
-		case 0xa4:
-			and_8080(state, state->h);
-			break;
-		case 0xa5:
-			and_8080(state, state->l);
-			break;
-		case 0xa7:
-			and_8080(state, state->a);
-			break;
-
-		// ANA M
-		case 0xa6:
-			and_8080(state, state_mem[combine_two_8bit(state->l, state->h)]);
-			break;
-
-		// ANI data
-		case 0xe6:
-			and_8080(state, opcode[1]);
-			state->cf.ac = 0;
-			state->pc++;
-			break;
-
-		// XRA r
-		case 0xa8:
-			xor_8080(state, state->b);
-			break;
-		case 0xa9:
-			xor_8080(state, state->c);
-			break;
-		case 0xaa:
-			xor_8080(state, state->d);
-			break;
-		case 0xab:
-			xor_8080(state, state->e);
-			break;
-		case 0xac:
-			xor_8080(state, state->h);
-			break;
-		case 0xad:
-			xor_8080(state, state->l);
-			break;
-		case 0xaf:
-			xor_8080(state, state->a);
-			break;
-
-		// XRA M
-		case 0xae:
-			xor_8080(state, state_mem[combine_two_8bit(state->l, state->h)]);
-			break;
-
-		// XRI data
-		case 0xee:
-			xor_8080(state, opcode[1]);
-			state->pc++;
-			break;
-
-		// ORA r
-		case 0xb0:
-			or_8080(state, state->b);
-			break;
-		case 0xb1:
-			or_8080(state, state->c);
-			break;
-		case 0xb2:
-			or_8080(state, state->d);
-			break;
-		case 0xb3:
-			or_8080(state, state->e);
-			break;
-		case 0xb4:
-			or_8080(state, state->h);
-			break;
-		case 0xb5:
-			or_8080(state, state->l);
-			break;
-		case 0xb7:
-			or_8080(state, state->a);
-			break;
-
-		// ORA M
-		case 0xb6:
-			or_8080(state, state_mem[combine_two_8bit(state->l, state->h)]);
-			break;
-
-		// ORI data
-		case 0xf6:
-			or_8080(state, opcode[1]);
-			state->pc++;
-			break;
-
-		// CMP r
-		case 0xb8:
-			cmp_8080(state, state->b);
-			break;
-		case 0xb9:
-			cmp_8080(state, state->c);
-			break;
-		case 0xba:
-			cmp_8080(state, state->d);
-			break;
-		case 0xbb:
-			cmp_8080(state, state->e);
-			break;
-		case 0xbc:
-			cmp_8080(state, state->h);
-			break;
-		case 0xbd:
-			cmp_8080(state, state->l);
-			break;
-		case 0xbf:
-			cmp_8080(state, state->a);
-			break;
+		}
+	}
+	return SNAPSHOT_8080_SIZE;
+}
 
-		// CMP M
-		case 0xbe:
-			cmp_8080(state, state_mem[combine_two_8bit(state->l, state->h)]);
-			break;
+uint8_t *alloc_memory_8080(void)
+{
+	// anonymous pages come zeroed and page aligned, so ROM pages can be protected
+	void *memory = mmap(NULL, MEMORY_SIZE_8080 + MEMORY_PADDING_8080, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ( memory == MAP_FAILED )
+	{
+		return NULL;
+	}
+	return memory;
+}
 
-		// CPI data
-		case 0xfe:
-			cmp_8080(state, opcode[1]);
-			state->pc++;
-			break;
+void free_memory_8080(uint8_t *memory)
+{
+	munmap(memory, MEMORY_SIZE_8080 + MEMORY_PADDING_8080);
+}
 
-		// RLC
-		case 0x07:
-			state->cf.cy = state->a >> 7;
-			state->a = (state->a << 1) | state->cf.cy;
+struct Fork8080 *fork_8080_create(const uint8_t *memory)
+{
+	struct Fork8080 *fork = malloc(sizeof(struct Fork8080));
+	if ( fork == NULL )
+	{
+		return NULL;
+	}
+#ifdef MFD_CLOEXEC
+	fork->fd = memfd_create("memory_8080", MFD_CLOEXEC);
+#else
+	// an unlinked temporary file does the same where there is no memfd
+	char path[] = "/tmp/memory_8080_XXXXXX";
+	fork->fd = mkstemp(path);
+	if ( fork->fd >= 0 )
+	{
+		unlink(path);
+	}
+#endif
+	size_t size = MEMORY_SIZE_8080 + MEMORY_PADDING_8080;
+	size_t done = 0;
+	if ( fork->fd < 0 || ftruncate(fork->fd, size) != 0 )
+	{
+		done = size + 1;
+	}
+	while ( done < size )
+	{
+		ssize_t n = pwrite(fork->fd, memory + done, size - done, done);
+		if ( n <= 0 )
+		{
 			break;
+		}
+		done += n;
+	}
+	if ( done != size )
+	{
+		if ( fork->fd >= 0 )
+		{
+			close(fork->fd);
+		}
+		free(fork);
+		return NULL;
+	}
+	return fork;
+}
 
-		// RRC
-		case 0x0f:
-			state->cf.cy = state->a & 0x01;
-			state->a = (state->cf.cy << 7) | (state->a >> 1);
-			break;
+uint8_t *fork_8080_memory(struct Fork8080 *fork)
+{
+	void *memory = mmap(NULL, MEMORY_SIZE_8080 + MEMORY_PADDING_8080, PROT_READ | PROT_WRITE, MAP_PRIVATE, fork->fd, 0);
+	if ( memory == MAP_FAILED )
+	{
+		return NULL;
+	}
+	return memory;
+}
 
-		// RAL
-		case 0x17:
-			{
-				uint8_t tmp = state->a >> 7;
-				state->a = (state->a << 1) | state->cf.cy;
-				state->cf.cy = tmp;
-			}
-			break;
+void fork_8080_destroy(struct Fork8080 *fork)
+{
+	if ( fork == NULL )
+	{
+		return;
+	}
+	close(fork->fd);
+	free(fork);
+}
 
-		// RAR
-		case 0x1f:
+// The XOR of a and b as runs (see struct Rewind8080); returns its size.
+// 'out' must have room for 2 * size + 16 bytes.
+static int xor_delta_8080(const uint8_t *a, const uint8_t *b, int size, uint8_t *out)
+{
+	uint8_t *start = out;
+	int at = 0;
+	for ( ;; )
+	{
+		int equal = at;
+		for ( uint64_t x, y; equal + 8 <= size; equal += 8 )
+		{
+			memcpy(&x, &a[equal], 8);
+			memcpy(&y, &b[equal], 8);
+			if ( x != y )
 			{
-				uint8_t tmp = state->a & 0x01;
-				state->a = (state->cf.cy << 7) | (state->a >> 1);
-				state->cf.cy = tmp;
+				break;
 			}
-			break;
-
-		// CMA
-		case 0x2f:
-			state->a = ~state->a;
-			break;
-
-		// CMC
-		case 0x3f:
-			state->cf.cy = ~state->cf.cy;
-			break;
-
-		// STC
-		case 0x37:
-			state->cf.cy = 1;
-			break;
-
-		// JMP addr
-		case 0xc3:
-			state->pc = combine_two_8bit(opcode[1], opcode[2]);
-			break;
+		}
+		while ( equal < size && a[equal] == b[equal] )
+		{
+			equal++;
+		}
+		if ( equal == size )
+		{
+			// equal to the end: nothing more to write
+			return out - start;
+		}
+		// a run of differences goes on over fewer than 3 equal bytes, which
+		// would cost more to skip than to copy
+		int differ = equal + 1;
+		while ( differ < size && !(differ + 3 <= size && a[differ] == b[differ] && a[differ + 1] == b[differ + 1] && a[differ + 2] == b[differ + 2]) )
+		{
+			differ++;
+		}
+		out = put_varint_8080(out, equal - at);
+		out = put_varint_8080(out, differ - equal);
+		for ( int i = equal; i < differ; i++ )
+		{
+			*out++ = a[i] ^ b[i];
+		}
+		at = differ;
+	}
+}
 
-		// Jcondition addr
-		case 0xc2:
-			jmp_8080(state, opcode[1], opcode[2], 0);
-			break;
-		case 0xca:
-			jmp_8080(state, opcode[1], opcode[2], 1);
-			break;
-		case 0xd2:
-			jmp_8080(state, opcode[1], opcode[2], 2);
-			break;
-		case 0xda:
-			jmp_8080(state, opcode[1], opcode[2], 3);
-			break;
-		case 0xe2:
-			jmp_8080(state, opcode[1], opcode[2], 4);
-			break;
-		case 0xea:
-			jmp_8080(state, opcode[1], opcode[2], 5);
-			break;
-		case 0xf2:
-			jmp_8080(state, opcode[1], opcode[2], 6);
-			break;
-		case 0xfa:
-			jmp_8080(state, opcode[1], opcode[2], 7);
-			break;
+static void apply_delta_8080(uint8_t *blob, const uint8_t *delta, int size)
+{
+	const uint8_t *end = delta + size;
+	while ( delta < end )
+	{
+		blob += get_varint_8080(&delta);
+		uint64_t count = get_varint_8080(&delta);
+		for ( uint64_t i = 0; i < count; i++ )
+		{
+			*blob++ ^= *delta++;
+		}
+	}
+}
 
-		// CALL addr
-		case 0xcd:
-			call_8080(state, opcode[1], opcode[2], 8);
-			break;
+int rewind_8080_init(struct Rewind8080 *rewind, int blob_size, int mark_size, int max_states, size_t max_bytes)
+{
+	*rewind = (struct Rewind8080){ .blob_size = blob_size, .max_states = max_states < 1 ? 1 : max_states, .max_bytes = max_bytes, .mark_size = mark_size };
+	rewind->newest = malloc(blob_size);
+	rewind->work = malloc(blob_size);
+	rewind->scratch = malloc(2 * (size_t)blob_size + 16);
+	rewind->older = calloc(rewind->max_states, sizeof(struct RewindState8080));
+	if ( rewind->newest == NULL || rewind->work == NULL || rewind->scratch == NULL || rewind->older == NULL )
+	{
+		rewind_8080_free(rewind);
+		return -1;
+	}
+	return 0;
+}
 
-		// Ccondition addr
-		case 0xc4:
-			call_8080(state, opcode[1], opcode[2], 0);
-			break;
-		case 0xcc:
-			call_8080(state, opcode[1], opcode[2], 1);
-			break;
-		case 0xd4:
-			call_8080(state, opcode[1], opcode[2], 2);
-			break;
-		case 0xdc:
-			call_8080(state, opcode[1], opcode[2], 3);
-			break;
-		case 0xe4:
-			call_8080(state, opcode[1], opcode[2], 4);
-			break;
-		case 0xec:
-			call_8080(state, opcode[1], opcode[2], 5);
-			break;
-		case 0xf4:
-			call_8080(state, opcode[1], opcode[2], 6);
-			break;
-		case 0xfc:
-			call_8080(state, opcode[1], opcode[2], 7);
-			break;
+// Forgets the oldest delta
+static void rewind_8080_drop(struct Rewind8080 *rewind)
+{
+	struct RewindState8080 *oldest = &rewind->older[rewind->first];
+	rewind->bytes -= oldest->size;
+	free(oldest->delta);
+	oldest->delta = NULL;
+	rewind->first = (rewind->first + 1) % rewind->max_states;
+	rewind->count--;
+}
 
-		// RET addr
-		case 0xc9:
-			ret_8080(state, 8);
-			break;
+void rewind_8080_free(struct Rewind8080 *rewind)
+{
+	while ( rewind->older != NULL && rewind->count > 0 )
+	{
+		rewind_8080_drop(rewind);
+	}
+	free(rewind->marks);
+	free(rewind->older);
+	free(rewind->scratch);
+	free(rewind->work);
+	free(rewind->newest);
+	*rewind = (struct Rewind8080){ 0 };
+}
 
-		// Rcondition addr
-		case 0xc0:
-			ret_8080(state, 0);
-			break;
-		case 0xc8:
-			ret_8080(state, 1);
-			break;
-		case 0xd0:
-			ret_8080(state, 2);
-			break;
-		case 0xd8:
-			ret_8080(state, 3);
-			break;
-		case 0xe0:
-			ret_8080(state, 4);
-			break;
-		case 0xe8:
-			ret_8080(state, 5);
-			break;
-		case 0xf0:
-			ret_8080(state, 6);
-			break;
-		case 0xf8:
-			ret_8080(state, 7);
-			break;
+int rewind_8080_push(struct Rewind8080 *rewind, const uint8_t *blob, uint64_t tag)
+{
+	// with max_states 1 only the newest is kept, and there is no delta to make
+	if ( rewind->states > 0 && rewind->max_states > 1 )
+	{
+		int size = xor_delta_8080(rewind->newest, blob, rewind->blob_size, rewind->scratch);
+		uint8_t *delta = malloc(size ? size : 1);
+		if ( delta == NULL )
+		{
+			return -1;
+		}
+		memcpy(delta, rewind->scratch, size);
+		// the newest state is always kept whole, so the ring holds one less
+		if ( rewind->count > 0 && rewind->count == rewind->max_states - 1 )
+		{
+			rewind_8080_drop(rewind);
+		}
+		struct RewindState8080 *older = &rewind->older[(rewind->first + rewind->count) % rewind->max_states];
+		*older = (struct RewindState8080){ rewind->newest_tag, delta, size };
+		rewind->count++;
+		rewind->bytes += size;
+	}
+	memcpy(rewind->newest, blob, rewind->blob_size);
+	rewind->newest_tag = tag;
+	while ( rewind->bytes > rewind->max_bytes && rewind->count > 0 )
+	{
+		rewind_8080_drop(rewind);
+	}
+	rewind->states = rewind->count + 1;
+	// marks from before the oldest snapshot can no longer be run through
+	uint64_t oldest = rewind->count > 0 ? rewind->older[rewind->first].tag : rewind->newest_tag;
+	if ( rewind->marks_count > 0 && oldest > rewind->marks_tag )
+	{
+		size_t gone = oldest - rewind->marks_tag < rewind->marks_count ? oldest - rewind->marks_tag : rewind->marks_count;
+		memmove(rewind->marks, rewind->marks + gone * rewind->mark_size, (rewind->marks_count - gone) * rewind->mark_size);
+		rewind->marks_count -= gone;
+		rewind->marks_tag += gone;
+	}
+	return 0;
+}
 
-		// RST n
-		case 0xc7:
-			rst_8080(state, 0);
-			break;
-		case 0xcf:
-			rst_8080(state, 1);
-			break;
-		case 0xd7:
-			rst_8080(state, 2);
-			break;
-		case 0xdf:
-			rst_8080(state, 3);
-			break;
-		case 0xe7:
-			rst_8080(state, 4);
-			break;
-		case 0xef:
-			rst_8080(state, 5);
-			break;
-		case 0xf7:
-			rst_8080(state, 6);
-			break;
-		case 0xff:
-			rst_8080(state, 7);
+int rewind_8080_seek(struct Rewind8080 *rewind, uint64_t tag, uint8_t *blob, uint64_t *found)
+{
+	if ( rewind->states == 0 )
+	{
+		return -1;
+	}
+	memcpy(blob, rewind->newest, rewind->blob_size);
+	if ( rewind->newest_tag <= tag )
+	{
+		*found = rewind->newest_tag;
+		return 0;
+	}
+	// undo the deltas, newest first, down to the state wanted (or the oldest)
+	int keep = rewind->count;
+	while ( keep > 0 )
+	{
+		struct RewindState8080 *older = &rewind->older[(rewind->first + keep - 1) % rewind->max_states];
+		apply_delta_8080(blob, older->delta, older->size);
+		keep--;
+		*found = older->tag;
+		if ( older->tag <= tag )
+		{
 			break;
+		}
+	}
+	// the run goes on from there, so what came after it is forgotten
+	while ( rewind->count > keep )
+	{
+		struct RewindState8080 *newer = &rewind->older[(rewind->first + rewind->count - 1) % rewind->max_states];
+		rewind->bytes -= newer->size;
+		free(newer->delta);
+		newer->delta = NULL;
+		rewind->count--;
+	}
+	memcpy(rewind->newest, blob, rewind->blob_size);
+	rewind->newest_tag = *found;
+	rewind->states = rewind->count + 1;
+	if ( tag < rewind->marks_tag )
+	{
+		rewind->marks_count = 0;
+	}
+	else if ( tag - rewind->marks_tag < rewind->marks_count )
+	{
+		rewind->marks_count = tag - rewind->marks_tag + 1;
+	}
+	return 0;
+}
 
-		// PCHL
-		case 0xe9:
-			state->pc = combine_two_8bit(state->l, state->h);
-			break;
+int rewind_8080_mark(struct Rewind8080 *rewind, uint64_t tag, const uint8_t *mark)
+{
+	if ( rewind->marks_count == 0 || tag < rewind->marks_tag || tag - rewind->marks_tag > rewind->marks_count )
+	{
+		rewind->marks_tag = tag;
+		rewind->marks_count = 0;
+	}
+	size_t at = tag - rewind->marks_tag;
+	if ( at == rewind->marks_capacity )
+	{
+		size_t capacity = rewind->marks_capacity ? rewind->marks_capacity * 2 : 4096;
+		uint8_t *marks = realloc(rewind->marks, capacity * rewind->mark_size);
+		if ( marks == NULL )
+		{
+			return -1;
+		}
+		rewind->marks = marks;
+		rewind->marks_capacity = capacity;
+	}
+	memcpy(rewind->marks + at * rewind->mark_size, mark, rewind->mark_size);
+	rewind->marks_count = at + 1;
+	return 0;
+}
 
-		// PUSH rp
-		case 0xc5:
-			state_mem[state->sp - 1] = state->b;
-			state_mem[state->sp - 2] = state->c;
-			state->sp -= 2;
-			break;
-		case 0xd5:
-			state_mem[state->sp - 1] = state->d;
-			state_mem[state->sp - 2] = state->e;
-			state->sp -= 2;
-			break;
-		case 0xe5:
-			state_mem[state->sp - 1] = state->h;
-			state_mem[state->sp - 2] = state->l;
-			state->sp -= 2;
-			break;
+const uint8_t *rewind_8080_marked(const struct Rewind8080 *rewind, uint64_t tag)
+{
+	if ( tag < rewind->marks_tag || tag - rewind->marks_tag >= rewind->marks_count )
+	{
+		return NULL;
+	}
+	return rewind->marks + (tag - rewind->marks_tag) * rewind->mark_size;
+}
 
-		// PUSH PSW
-		case 0xf5:
-			state_mem[state->sp - 1] = state->a;
-			state_mem[state->sp - 2] = (state->cf.s << 7) | (state->cf.z << 6) | (state->cf.ac << 4) | (state->cf.p << 2) | 0x2 | state->cf.cy;
-			state->sp -= 2;
-			break;
+int load_rom_8080(uint8_t *memory, const char *path, uint16_t origin, int flags)
+{
+	int fd = open(path, O_RDONLY);
+	if ( fd < 0 )
+	{
+		printf("error: Could not open %s\n", path);
+		return -1;
+	}
+	struct stat st;
+	if ( fstat(fd, &st) != 0 || origin + st.st_size > MEMORY_SIZE_8080 )
+	{
+		printf("error: %s does not fit in memory at $%04x\n", path, origin);
+		close(fd);
+		return -1;
+	}
 
-		// POP rp
-		case 0xc1:
-			state->c = state_mem[state->sp];
-			state->b = state_mem[state->sp + 1];
-			state->sp += 2;
-			break;
-		case 0xd1:
-			state->c = state_mem[state->sp];
-			state->b = state_mem[state->sp + 1];
-			state->sp += 2;
-			break;
-		case 0xe1:
-			state->c = state_mem[state->sp];
-			state->b = state_mem[state->sp + 1];
-			state->sp += 2;
-			break;
+	size_t size = st.st_size;
+	size_t done = 0;
+	long page = sysconf(_SC_PAGESIZE);
+	if ( (flags & ROM_SHARED_8080) && origin % page == 0 && size >= (size_t)page )
+	{
+		// map the whole pages of the image over guest memory, read-only and
+		// shared, so every instance running this ROM uses the same page cache
+		size_t whole = size / page * page;
+		if ( mmap(&memory[origin], whole, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED )
+		{
+			done = whole;
+		}
+	}
+	if ( (flags & ROM_MMAP_8080) && done < size )
+	{
+		// copy the rest straight out of the page cache
+		uint8_t *image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if ( image != MAP_FAILED )
+		{
+			memcpy(&memory[origin + done], image + done, size - done);
+			munmap(image, size);
+			done = size;
+		}
+	}
+	while ( done < size )
+	{
+		ssize_t n = pread(fd, &memory[origin + done], size - done, done);
+		if ( n <= 0 )
+		{
+			printf("error: Could not read %s\n", path);
+			close(fd);
+			return -1;
+		}
+		done += n;
+	}
+	close(fd);
+	return size;
+}
 
-		// POP PSW
-		case 0xf1:
+int load_rom_set_8080(uint8_t *memory, const char *dir, const struct RomPart8080 *parts, int count, int flags)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	long covered[MEMORY_SIZE_8080 / 4096] = { 0 };    // ROM bytes in each host page
+	char path[4096];
+	int total = 0;
+	for ( int i = 0; i < count; i++ )
+	{
+		const char *part = parts[i].path;
+		if ( dir != NULL )
+		{
+			snprintf(path, sizeof(path), "%s/%s", dir, parts[i].path);
+			part = path;
+		}
+		int size = load_rom_8080(memory, part, parts[i].origin, flags);
+		if ( size < 0 )
+		{
+			return -1;
+		}
+		for ( long addr = parts[i].origin; addr < parts[i].origin + size; )
+		{
+			long end = (addr / page + 1) * page;
+			if ( end > parts[i].origin + size )
 			{
-				uint8_t word = state_mem[state->sp];
-				state->cf.cy = word & 0x1;
-				state->cf.p = (word >> 2) & 0x1;
-				state->cf.ac = (word >> 4) & 0x1;
-				state->cf.z = (word >> 6) & 0x1;
-				state->cf.s = (word >> 7) & 0x1;
+				end = parts[i].origin + size;
 			}
-			state->a = state_mem[state->sp + 1];
-			state->sp += 2;
-			break;
+			covered[addr / page] += end - addr;
+			addr = end;
+		}
+		total += size;
+	}
 
-		// XTHL
-		case 0xe3:
+	if ( flags & ROM_PROTECT_8080 )
+	{
+		// only pages holding nothing but ROM can be made read-only
+		for ( long p = 0; p < MEMORY_SIZE_8080 / page; p++ )
+		{
+			if ( covered[p] == page && mprotect(memory + p * page, page, PROT_READ) != 0 )
 			{
-				uint8_t tmp = state_mem[state->sp];
-				state_mem[state->sp] = state->l;
-				state->l = tmp;
-				tmp = state_mem[state->sp + 1];
-				state_mem[state->sp + 1] = state->h;
-				state->h = tmp;
+				printf("error: Could not protect ROM page at $%04lx\n", p * page);
+				return -1;
 			}
-			break;
-
-		// SPHL
-		case 0xf9:
-			state->sp = combine_two_8bit(state->l, state->h);
-			break;
-
-		// IN port
-		case 0xdb:
-			printf("IN    #0x%02x", opcode[1]);
-			state->pc++;
-			break;
+		}
+	}
+	return total;
+}
 
-		// OUT port
-		case 0xd3:
-			printf("OUT   #0x%02x", opcode[1]);
-			state->pc++;
-			break;
+// Build with -DEMULATOR_8080_NO_MAIN to link the emulator core into other tools
+#ifndef EMULATOR_8080_NO_MAIN
+static struct Trace8080 trace;
+static const char *trace_path;
 
-		// EI
-		case 0xfb:
-			printf("EI");
-			state->int_enable = 1;
-			break;
+// Runs at exit, including after an unassigned instruction, so the last
+// TRACE_8080_SIZE instructions are always available to trace_8080
+void save_trace(void)
+{
+	FILE *f = fopen(trace_path, "wb");
+	if ( f == NULL || trace_8080_write(&trace, f) != 0 )
+	{
+		printf("error: Could not write trace to %s\n", trace_path);
+	}
+	if ( f != NULL )
+	{
+		fclose(f);
+	}
+}
 
-		// DI
-		case 0xf3:
-			unassigned_instruction(state);
-			break;
+static struct Profile8080 *profile;
+static const char *profile_path;
+static uint8_t *profile_memory;
 
-		// HLT
-		case 0x76:
-			unassigned_instruction(state);
-			break;
+// Written however the emulator stops, with the memory for the disassembly
+void save_profile(void)
+{
+	if ( profile_memory == NULL )
+	{
+		return;
+	}
+	FILE *f = fopen(profile_path, "wb");
+	if ( f == NULL || profile_8080_write(profile, profile_memory, f) != 0 )
+	{
+		printf("error: Could not write profile to %s\n", profile_path);
+	}
+	if ( f != NULL )
+	{
+		fclose(f);
+	}
+}
 
-		// NOP
-		case 0x00:
-			break;
+static struct Replay8080 replay;
+static long long replay_total;
+static const char *replay_path;
 
-		default:
-			puts("missing instruction!!!");
-			break;
+// A recorded log is written however the emulator stops, like the trace
+void save_replay(void)
+{
+	if ( replay.mode == REPLAY_8080_PLAY )
+	{
+		if ( replay.diverged && replay.reads < (uint64_t)replay_total )
+		{
+			printf("note: Input diverged from %s after %llu of %lld reads\n", replay_path, (unsigned long long)replay.reads, replay_total);
+		}
+		return;
+	}
+	FILE *f = fopen(replay_path, "wb");
+	if ( f == NULL || replay_8080_write(&replay, f) != 0 )
+	{
+		printf("error: Could not write input log to %s\n", replay_path);
+	}
+	if ( f != NULL )
+	{
+		fclose(f);
 	}
-	printf("\tC=%d,P=%d,S=%d,Z=%d\n", state->cf.cy, state->cf.p, state->cf.s, state->cf.z);
-	printf("\tA $%02x B $%02x C $%02x D $%02x E $%02x H $%02x L $%02x SP %04x\n", state->a, state->b, state->c, state->d, state->e, state->h, state->l, state->sp);      
-	state->pc++;
-	return 0;
 }
 
-void initialize_state(struct State8080 *state, uint16_t pc, uint8_t *buffer)
+static const char *frame_path;
+static uint8_t *frame_memory;
+
+// Like the trace, the screen is written however the emulator stops
+void save_frame(void)
 {
-	state->pc = pc;
-	state->cf.ac = 0;
-	state->cf.cy = 0;
-	state->cf.p = 0;
-	state->cf.s = 0;
-	state->cf.z = 0;
-	state->a = 0;
-	state->b = 0;
-	state->c = 0;
-	state->d = 0;
-	state->e = 0;
-	state->h = 0;
-	state->l = 0;
-	state->int_enable = 0;
-	state->sp = 0;
-	state->memory = buffer;
+	if ( frame_memory == NULL )
+	{
+		return;
+	}
+	if ( frame_8080_write_pgm(frame_memory, frame_path) != 0 )
+	{
+		printf("error: Could not write frame to %s\n", frame_path);
+	}
 }
 
+// Built with -DRECOMPILED_8080=run_name_8080 and the output of recompile_8080,
+// -a runs the CPU through that function
+#ifdef RECOMPILED_8080
+int RECOMPILED_8080(struct State8080 *state, int budget);
+#endif
+
 int main(int argc, char *argv[])
 {
-	FILE *f = fopen(argv[1], "rb"); // open binary file in read-only mode
-	if ( f == NULL )
+	// usage: emulator_8080 [-t trace_file] [-g profile_file] [-f frame_file] [-c max_cycles] [-w in_log | -i in_log] [-p] [-s] [-d] [-j] [-a] (-r rom_dir | rom[@origin]...)
+	long long max_cycles = -1;
+	const char *rom_dir = NULL;
+	int rom_flags = ROM_MMAP_8080;
+	int use_decode = 0;
+	int use_jit = 0;
+	int use_recompiled = 0;
+	int opt;
+	while ( (opt = getopt(argc, argv, "t:g:f:c:w:i:r:psdja")) != -1 )
 	{
-		printf("error: Could not open %s\n", argv[1]);
+		switch (opt)
+		{
+			case 't': trace_path = optarg; break;
+			case 'g': profile_path = optarg; break;
+			case 'f': frame_path = optarg; break;
+			case 'c': max_cycles = strtoll(optarg, NULL, 0); break;
+			case 'w': replay_path = optarg; replay.mode = REPLAY_8080_RECORD; break;
+			case 'i': replay_path = optarg; replay.mode = REPLAY_8080_PLAY; break;
+			case 'r': rom_dir = optarg; break;
+			case 'p': rom_flags |= ROM_PROTECT_8080; break;
+			case 's': rom_flags |= ROM_SHARED_8080; break;
+			case 'd': use_decode = 1; break;
+			case 'j': use_jit = 1; break;
+			case 'a': use_recompiled = 1; break;
+			default:
+				printf("usage: %s [-t trace_file] [-g profile_file] [-f frame_file] [-c max_cycles] [-w in_log | -i in_log] [-p] [-s] [-d] [-j] [-a] (-r rom_dir | rom[@origin]...)\n", argv[0]);
+				exit(1);
+		}
+	}
+	if ( optind >= argc && rom_dir == NULL )
+	{
+		printf("usage: %s [-t trace_file] [-g profile_file] [-f frame_file] [-c max_cycles] [-w in_log | -i in_log] [-p] [-s] [-d] [-j] [-a] (-r rom_dir | rom[@origin]...)\n", argv[0]);
 		exit(1);
 	}
 
-	// Get the file size and read it into a memory buffer
-	fseek(f, 0L, SEEK_END); // Set position of pointer to end of file
-	int fsize = ftell(f); // Get position of file pointer, i.e. how big the file is
-	fseek(f, 0L, SEEK_SET); // Reset position
-
-	unsigned char *buffer = malloc(fsize); // Allocate memory equal to the size of the file
-
-	fread(buffer, fsize, 1, f); // read into buffer the first byte of f
-	fclose(f);
+	uint8_t *memory = alloc_memory_8080();
+	if ( memory == NULL )
+	{
+		puts("error: Could not allocate guest memory");
+		exit(1);
+	}
+	int loaded;
+	if ( rom_dir != NULL )
+	{
+		loaded = load_rom_set_8080(memory, rom_dir, invaders_rom_set, INVADERS_ROM_PARTS, rom_flags);
+	}
+	else
+	{
+		// each image is loaded at address 0 unless an origin follows an '@'
+		struct RomPart8080 parts[argc - optind];
+		for ( int arg = optind; arg < argc; arg++ )
+		{
+			char *at = strrchr(argv[arg], '@');
+			parts[arg - optind].path = argv[arg];
+			parts[arg - optind].origin = 0;
+			if ( at != NULL )
+			{
+				*at = '\0';
+				parts[arg - optind].origin = strtol(at + 1, NULL, 0);
+			}
+		}
+		loaded = load_rom_set_8080(memory, NULL, parts, argc - optind, rom_flags);
+	}
+	if ( loaded < 0 )
+	{
+		exit(1);
+	}
 
-	struct State8080 state;
-	initialize_state(&state, 0, buffer);
-	while ( state.pc < fsize )
+	struct Invaders8080 machine;
+	invaders_8080_init(&machine, memory);
+	if ( trace_path )
+	{
+		machine.state.trace = &trace;
+		atexit(save_trace);
+	}
+	if ( profile_path )
+	{
+		profile = calloc(1, sizeof(struct Profile8080));
+		if ( profile == NULL )
+		{
+			puts("error: Could not allocate the profile");
+			exit(1);
+		}
+		profile_memory = memory;
+		machine.state.profile = profile;
+		atexit(save_profile);
+	}
+	if ( replay.mode == REPLAY_8080_PLAY )
+	{
+		FILE *f = fopen(replay_path, "rb");
+		if ( f == NULL || (replay_total = replay_8080_read(&replay, f)) < 0 )
+		{
+			printf("error: %s is not a version %d input log\n", replay_path, REPLAY_8080_VERSION);
+			exit(1);
+		}
+		fclose(f);
+	}
+	if ( replay_path )
+	{
+		machine.state.replay = &replay;
+		atexit(save_replay);
+	}
+	if ( frame_path )
+	{
+		frame_memory = memory;
+		atexit(save_frame);
+	}
+	struct Decode8080 *decode = NULL;
+	if ( use_decode )
+	{
+		decode = malloc(sizeof(struct Decode8080));
+		if ( decode == NULL )
+		{
+			puts("error: Could not allocate the decode cache");
+			exit(1);
+		}
+		initialize_decode(decode);
+		machine.state.decode = decode;
+		machine.scheduler.run = run_predecoded_8080;
+	}
+	if ( use_jit )
+	{
+		if ( jit_8080_create(&machine.state) != NULL )
+		{
+			machine.scheduler.run = run_jit_8080;
+		}
+		else
+		{
+			puts("note: No translator on this host, interpreting");
+		}
+	}
+	if ( use_recompiled )
+	{
+#ifdef RECOMPILED_8080
+		machine.scheduler.run = RECOMPILED_8080;
+#else
+		puts("note: Built without a recompiled ROM, interpreting");
+#endif
+	}
+	// runs, as fast as the host allows, until HLT (which exits) or the cycle limit
+	while ( max_cycles < 0 || machine.state.cycles < (uint64_t)max_cycles )
 	{
-		emulate_8080(&state);
+		run_scheduled_8080(&machine.state, &machine.scheduler, INVADERS_FRAME_CYCLES);
 	}
+	save_frame();
+	frame_memory = NULL;
+	save_profile();
+	profile_memory = NULL;
+	jit_8080_destroy(machine.state.jit);
+	free(decode);
+	free_memory_8080(memory);
 	return 0;
 }
+#endif
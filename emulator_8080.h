@@ -0,0 +1,321 @@
+#ifndef EMULATOR_8080_H
+#define EMULATOR_8080_H
+
+#include <stdint.h>
+
+#include "trace_8080.h"
+
+struct ConditionFlags {
+	uint8_t z:1;    // zero
+	uint8_t s:1;    // sign
+	uint8_t p:1;    // parity
+	uint8_t cy:1;   // carry
+	uint8_t ac:1;   // auxiliary carry
+	uint8_t pad:3;  // padding; this makes the struct 8 bit long
+};
+
+// Guest memory is the whole 16-bit address space. Every address is a
+// uint16_t, so accesses wrap around at 64 KiB and need no bounds check. The
+// padding lets an instruction at $ffff read its operand bytes (as zeros).
+#define MEMORY_SIZE_8080 0x10000
+#define MEMORY_PADDING_8080 64
+#define MEMORY_ALIGN_8080 64       // cache line
+
+// Flags whose value still has to be derived from lazy_result/lazy_aux
+#define LAZY_ZSP 0x1
+#define LAZY_CY  0x2
+#define LAZY_AC  0x4
+
+// Devices on the 256 I/O ports. Every entry must be set; initialize_ports
+// connects them all to handlers that read 0 and ignore writes.
+struct Ports8080 {
+	uint8_t (*in[256])(void *ctx, uint8_t port);
+	void (*out[256])(void *ctx, uint8_t port, uint8_t value);
+	void *ctx;                  // passed to every handler
+};
+
+// Remembers which lines of one range of guest memory were written since the
+// bits were last cleared; a line is 1 << shift bytes and there are at most 256
+#define DIRTY_8080_LINES 256
+
+struct Dirty8080 {
+	uint16_t base;
+	uint16_t size;
+	uint8_t shift;
+	uint64_t lines[DIRTY_8080_LINES / 64];  // bit n set: line n was written
+};
+
+// Pages of guest memory whose writes are reported to 'written', e.g. because
+// translated code was made from them
+#define WATCH_8080_PAGE_SHIFT 8
+#define WATCH_8080_PAGES (MEMORY_SIZE_8080 >> WATCH_8080_PAGE_SHIFT)
+
+struct Watch8080 {
+	uint8_t pages[WATCH_8080_PAGES];  // nonzero: report writes to this page
+	void (*written)(void *ctx, uint16_t addr);
+	void *ctx;
+};
+
+// Instructions as run_predecoded_8080 decoded them, one entry per address;
+// an entry is all zero until its address runs. A write to any byte of an
+// instruction empties its entry again.
+struct DecodedOp8080 {
+	int32_t handler;            // offset of the opcode's handler in run_predecoded_8080
+	uint8_t code[3];            // opcode and operand bytes
+	uint8_t cycles;             // cycles_8080 of the opcode
+};
+
+struct Decode8080 {
+	struct DecodedOp8080 ops[MEMORY_SIZE_8080];
+};
+
+struct Jit8080;
+struct Replay8080;
+struct Profile8080;
+
+struct State8080 {
+	uint8_t *memory;
+	uint8_t int_enable;
+	struct ConditionFlags cf;   // only current for flags not in lazy_pending
+	uint8_t a;                  // accumulator
+	uint8_t b;
+	uint8_t c;
+	uint8_t d;
+	uint8_t e;
+	uint8_t f;
+	uint8_t h;
+	uint8_t l;
+	uint16_t sp;                // stack pointer
+	uint16_t pc;                // program counter
+	uint64_t cycles;            // clock cycles executed since initialize_state
+	struct Trace8080 *trace;    // instruction ring buffer, NULL when tracing is off
+	struct Profile8080 *profile;    // execution counts, NULL when profiling is off
+	struct Ports8080 *ports;    // IN/OUT handlers, NULL when nothing is connected
+	struct Dirty8080 *dirty;    // write tracking, NULL when off
+	struct Watch8080 *watch;    // write notifications, NULL when off
+	struct Decode8080 *decode;  // predecoded instructions, NULL when off
+	struct Jit8080 *jit;        // translated code used by run_jit_8080, NULL when off
+	struct Replay8080 *replay;  // input log being recorded or played back, NULL when off
+	int8_t recompiled;          // memory holds the recompiled ROM: 1 yes, -1 no, 0 not checked yet
+	// ALU instructions only record their result; cf is brought up to date by
+	// materialize_flags when a flag is actually read
+	uint16_t lazy_result;       // result of the last ALU instruction, bit 8 is the carry out
+	uint8_t lazy_aux;           // bit 4 is the carry out of bit 3
+	uint8_t lazy_pending;       // LAZY_* flags that cf does not hold yet
+};
+
+void unassigned_instruction(struct State8080 *state);
+void materialize_flags(struct State8080 *state);
+uint8_t psw_8080(struct State8080 *state);
+void trace_8080_record(struct State8080 *state);
+// IN while state->replay is set, see replay_8080.h; 'cycles' is the cycle
+// count at the start of the instruction
+uint8_t replay_8080_in(struct State8080 *state, uint8_t port, uint64_t cycles);
+uint16_t combine_two_8bit(uint8_t byte1, uint8_t byte2);
+// A guest write with all the bookkeeping an instruction's store does
+void write_8080(struct State8080 *state, uint16_t addr, uint8_t value);
+
+// ALU and control flow helpers shared by every instruction of a group
+void add_8080(struct State8080 *state, uint8_t reg, uint8_t carry);
+void sub_8080(struct State8080 *state, uint8_t reg, uint8_t carry);
+void inr_8080(struct State8080 *state, uint8_t *reg);
+void dcr_8080(struct State8080 *state, uint8_t *reg);
+void inx_8080(struct State8080 *state, uint8_t pair);
+void dcx_8080(struct State8080 *state, uint8_t pair);
+void dad_8080(struct State8080 *state, uint8_t pair);
+void and_8080(struct State8080 *state, uint8_t reg);
+void xor_8080(struct State8080 *state, uint8_t reg);
+void or_8080(struct State8080 *state, uint8_t reg);
+void cmp_8080(struct State8080 *state, uint8_t reg);
+uint8_t condition_8080(struct State8080 *state, uint8_t cond);
+void jmp_8080(struct State8080 *state, uint8_t byte1, uint8_t byte2, uint8_t cond);
+// Return 1 when the call or return is taken
+uint8_t call_8080(struct State8080 *state, uint8_t byte1, uint8_t byte2, uint8_t cond);
+uint8_t ret_8080(struct State8080 *state, uint8_t cond);
+void rst_8080(struct State8080 *state, uint8_t nnn);
+
+// Clock cycles of every opcode; conditional CALL/RET take 6 more when taken
+extern const uint8_t cycles_8080[256];
+
+// Executes one instruction; returns the clock cycles it took. It is also the
+// only loop that counts into state->profile: the others hand over to it
+// while profiling.
+int emulate_8080(struct State8080 *state);
+// Executes instructions until at least 'budget' clock cycles have elapsed;
+// returns the cycles actually consumed, which may overshoot by one instruction
+int run_for_cycles_8080(struct State8080 *state, int budget);
+// Same, but fetches instructions through state->decode, which must be set;
+// each address is decoded once, on the first run after a write to it
+int run_predecoded_8080(struct State8080 *state, int budget);
+void initialize_state(struct State8080 *state, uint16_t pc, uint8_t *buffer);
+void initialize_ports(struct Ports8080 *ports, void *ctx);
+void initialize_dirty(struct Dirty8080 *dirty, uint16_t base, uint16_t size, uint8_t shift);
+void clear_dirty(struct Dirty8080 *dirty);
+// Empties every entry, e.g. after memory was changed without store_8080
+void initialize_decode(struct Decode8080 *decode);
+
+// Delivers RST nnn as an interrupt if interrupts are enabled (the 8080 then
+// disables them); returns 1 if it was accepted, 0 if it was ignored
+int interrupt_8080(struct State8080 *state, uint8_t nnn);
+
+// Cycle-driven event scheduler: run_scheduled_8080 executes instructions up
+// to the cycle at which the next event is due, fires it and carries on, so
+// events such as video interrupts happen at exact emulated times no matter
+// how fast the host runs.
+#define MAX_EVENTS_8080 8
+
+struct Event8080 {
+	uint64_t when;              // value of state->cycles the event is due at
+	void (*fire)(struct State8080 *state, void *ctx);
+	void *ctx;
+};
+
+struct Scheduler8080 {
+	int (*run)(struct State8080 *state, int budget);    // CPU loop between events
+	int count;
+	struct Event8080 events[MAX_EVENTS_8080];   // sorted by 'when'
+};
+
+// Starts empty, running the CPU with run_for_cycles_8080
+void initialize_scheduler(struct Scheduler8080 *scheduler);
+// Returns -1 when the scheduler is full
+int schedule_event_8080(struct Scheduler8080 *scheduler, uint64_t when, void (*fire)(struct State8080 *state, void *ctx), void *ctx);
+// Runs for 'budget' cycles, firing every event that falls due; returns the
+// cycles consumed
+int run_scheduled_8080(struct State8080 *state, struct Scheduler8080 *scheduler, int budget);
+
+/*
+ * Snapshots: the CPU and all of guest memory in a fixed-size little-endian
+ * blob, written into and read from a buffer the caller owns.
+ *
+ *   0   "8080" and SNAPSHOT_8080_VERSION
+ *   5   A B C D E H L
+ *   12  flags as PUSH PSW stores them, int_enable
+ *   14  SP, PC (16 bit), cycles (64 bit)
+ *   26  MEMORY_SIZE_8080 bytes of memory
+ *
+ * Devices save their own state after it (see invaders_8080_snapshot).
+ */
+#define SNAPSHOT_8080_VERSION 1
+#define SNAPSHOT_8080_HEADER 26
+#define SNAPSHOT_8080_SIZE (SNAPSHOT_8080_HEADER + MEMORY_SIZE_8080)
+
+// Little-endian fields of a snapshot, 'bytes' long
+void put_le_8080(uint8_t *buffer, uint64_t value, int bytes);
+uint64_t get_le_8080(const uint8_t *buffer, int bytes);
+// Returns the bytes written (SNAPSHOT_8080_SIZE), or -1 if 'size' is too small
+int snapshot_8080(struct State8080 *state, uint8_t *buffer, int size);
+// Returns the bytes read, or -1 if the buffer holds no snapshot of this
+// version. Memory is only written where it differs, through the same
+// bookkeeping as a guest store, so the decode cache, dirty bits and watched
+// pages stay right (and ROM pages protected by load_rom_8080 are fine as
+// long as the snapshot was taken with the same ROM). Tracing, ports and the
+// other attachments of 'state' are kept.
+int restore_8080(struct State8080 *state, const uint8_t *buffer, int size);
+
+// Zeroed, cache-line-aligned guest memory of MEMORY_SIZE_8080 bytes
+uint8_t *alloc_memory_8080(void);
+void free_memory_8080(uint8_t *memory);
+
+/*
+ * Copy-on-write forks of guest memory. fork_8080_create copies memory once
+ * into an in-memory file; every fork_8080_memory maps that file privately,
+ * so forks share all of it until they write, and then the host copies just
+ * the page written (4 KiB on most hosts, 16 pages of the 8080 space). The
+ * copy is frozen: later writes to the original memory are not seen by forks.
+ */
+struct Fork8080 {
+	int fd;                     // file holding the memory forks start from
+};
+
+// Returns NULL when no file can be made
+struct Fork8080 *fork_8080_create(const uint8_t *memory);
+// Guest memory holding the memory the fork was created from, or NULL; free
+// it with free_memory_8080. Pages load_rom_8080 protected are writable here.
+uint8_t *fork_8080_memory(struct Fork8080 *fork);
+// Forks already made stay valid
+void fork_8080_destroy(struct Fork8080 *fork);
+
+/*
+ * Rewind history: a bounded series of snapshots of one fixed size (e.g. from
+ * invaders_8080_snapshot), each tagged by the caller, e.g. with a frame
+ * count. Only the newest is kept whole; each older one is kept as its XOR
+ * with the next newer one, run-length coded as
+ *   varint   bytes that are the same in both
+ *   varint   bytes that differ, n
+ *   n bytes  their XOR
+ * (varints as in replay_8080.h) with the last equal run left out. Between
+ * two frames the ROM and most of RAM do not change, so a delta is a small
+ * fraction of a snapshot. Going back undoes the deltas from the newest down.
+ * The oldest ones are dropped to stay within max_states snapshots and
+ * max_bytes of deltas.
+ *
+ * Between snapshots the caller can also record mark_size bytes per tag,
+ * e.g. the inputs of every frame, to run forward from a snapshot exactly as
+ * the first time. Marks are kept for consecutive tags back to the oldest
+ * snapshot, and are not counted in max_bytes.
+ */
+struct RewindState8080 {
+	uint64_t tag;
+	uint8_t *delta;             // turns the next newer snapshot into this one
+	int size;
+};
+
+struct Rewind8080 {
+	int blob_size;
+	int max_states;
+	size_t max_bytes;
+	int states;                 // snapshots held, the newest included
+	uint8_t *newest;            // the newest snapshot, whole
+	uint64_t newest_tag;
+	struct RewindState8080 *older;  // ring of the others, oldest at 'first'
+	int first;
+	int count;
+	size_t bytes;               // size of all the deltas
+	uint8_t *scratch;           // delta being made
+	uint8_t *work;              // blob_size bytes for the caller, e.g. to snapshot into
+	int mark_size;
+	uint8_t *marks;             // mark_size bytes for each tag from marks_tag on
+	uint64_t marks_tag;
+	size_t marks_count;
+	size_t marks_capacity;      // in marks
+};
+
+// Returns -1 if it could not allocate
+int rewind_8080_init(struct Rewind8080 *rewind, int blob_size, int mark_size, int max_states, size_t max_bytes);
+void rewind_8080_free(struct Rewind8080 *rewind);
+// Adds a snapshot taken after all the others; returns -1 if out of memory
+int rewind_8080_push(struct Rewind8080 *rewind, const uint8_t *blob, uint64_t tag);
+// Copies into 'blob' the newest snapshot tagged at most 'tag' (the oldest
+// one if they are all newer) and sets *found to its tag. Every newer
+// snapshot, and every mark after 'tag', is forgotten, as the run goes on
+// from there. Returns -1 if there are none.
+int rewind_8080_seek(struct Rewind8080 *rewind, uint64_t tag, uint8_t *blob, uint64_t *found);
+// Records the mark for 'tag', which follows the last one marked (a tag that
+// doesn't starts the marks over), forgetting any after it; returns -1 if
+// out of memory
+int rewind_8080_mark(struct Rewind8080 *rewind, uint64_t tag, const uint8_t *mark);
+// The mark recorded for 'tag', or NULL
+const uint8_t *rewind_8080_marked(const struct Rewind8080 *rewind, uint64_t tag);
+
+#define ROM_MMAP_8080    0x1    // read images through mmap instead of read()
+#define ROM_PROTECT_8080 0x2    // make host pages holding only ROM read-only
+// Map the whole pages of an image (loaded at a page-aligned origin) read-only
+// and MAP_SHARED over guest memory, so all instances share one copy. RAM
+// stays private; a partial last page is copied as usual.
+#define ROM_SHARED_8080  0x4
+
+// One image of a ROM set and the address it is loaded at
+struct RomPart8080 {
+	const char *path;
+	uint16_t origin;
+};
+
+// Copies a ROM image into memory at 'origin'; returns its size or -1
+int load_rom_8080(uint8_t *memory, const char *path, uint16_t origin, int flags);
+// Loads every part (relative to 'dir' unless it is NULL) in one pass;
+// returns the total size or -1. With ROM_PROTECT_8080 a guest write to a
+// protected page faults instead of silently changing the ROM.
+int load_rom_set_8080(uint8_t *memory, const char *dir, const struct RomPart8080 *parts, int count, int flags);
+
+#endif
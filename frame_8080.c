@@ -0,0 +1,345 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "frame_8080.h"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <immintrin.h>
+#define FRAME_8080_X86
+#endif
+
+/*
+ * Every VRAM byte covers 8 vertically adjacent pixels of one screen column:
+ * byte k of column x holds rows 255 - 8k - bit. The scalar versions walk the
+ * bytes in memory order and scatter the bits. The SIMD versions transpose
+ * 16x16 blocks of bytes so that a register holds the same byte of 16
+ * neighbouring columns, then expand one bit of it into 16 pixels of a row
+ * with an AND and a compare.
+ */
+
+static inline int frame_row(int k, int bit)
+{
+	return FRAME_8080_HEIGHT - 1 - (k * 8 + bit);
+}
+
+// Whether any of the 'width' (< 64, aligned) columns from x0 on has to be
+// converted again; a NULL bitmap means all of them
+static inline int columns_dirty(const uint64_t *dirty, int x0, int width)
+{
+	if ( dirty == NULL )
+	{
+		return 1;
+	}
+	return ((dirty[x0 >> 6] >> (x0 & 63)) & (((uint64_t)1 << width) - 1)) != 0;
+}
+
+void gray_scalar(const uint8_t *memory, uint8_t *out, const uint64_t *dirty)
+{
+	const uint8_t *vram = memory + FRAME_8080_VRAM;
+	for ( int x = 0; x < FRAME_8080_WIDTH; x++ )
+	{
+		if ( !columns_dirty(dirty, x, 1) )
+		{
+			continue;
+		}
+		for ( int k = 0; k < FRAME_8080_COLUMN_BYTES; k++ )
+		{
+			uint8_t byte = vram[x * FRAME_8080_COLUMN_BYTES + k];
+			for ( int bit = 0; bit < 8; bit++ )
+			{
+				out[frame_row(k, bit) * FRAME_8080_WIDTH + x] = ((byte >> bit) & 0x1) ? 0xff : 0;
+			}
+		}
+	}
+}
+
+void rgba_scalar(const uint8_t *memory, uint32_t *out, uint32_t fg, uint32_t bg, const uint64_t *dirty)
+{
+	const uint8_t *vram = memory + FRAME_8080_VRAM;
+	for ( int x = 0; x < FRAME_8080_WIDTH; x++ )
+	{
+		if ( !columns_dirty(dirty, x, 1) )
+		{
+			continue;
+		}
+		for ( int k = 0; k < FRAME_8080_COLUMN_BYTES; k++ )
+		{
+			uint8_t byte = vram[x * FRAME_8080_COLUMN_BYTES + k];
+			for ( int bit = 0; bit < 8; bit++ )
+			{
+				out[frame_row(k, bit) * FRAME_8080_WIDTH + x] = ((byte >> bit) & 0x1) ? fg : bg;
+			}
+		}
+	}
+}
+
+#ifdef FRAME_8080_X86
+// Loads the 16 bytes from k0 on of the 16 columns from x0 on and transposes
+// them: afterwards r[j] holds byte k0 + j of columns x0 to x0 + 15. Four
+// rounds of interleaving row i with row i + 8 is a full 16x16 transpose.
+static inline __attribute__((always_inline)) void load_block(const uint8_t *vram, int x0, int k0, __m128i r[16])
+{
+	for ( int i = 0; i < 16; i++ )
+	{
+		r[i] = _mm_loadu_si128((const __m128i *)(vram + (x0 + i) * FRAME_8080_COLUMN_BYTES + k0));
+	}
+	for ( int round = 0; round < 4; round++ )
+	{
+		__m128i t[16];
+		for ( int i = 0; i < 8; i++ )
+		{
+			t[2 * i] = _mm_unpacklo_epi8(r[i], r[i + 8]);
+			t[2 * i + 1] = _mm_unpackhi_epi8(r[i], r[i + 8]);
+		}
+		for ( int i = 0; i < 16; i++ )
+		{
+			r[i] = t[i];
+		}
+	}
+}
+
+void gray_sse2(const uint8_t *memory, uint8_t *out, const uint64_t *dirty)
+{
+	const uint8_t *vram = memory + FRAME_8080_VRAM;
+	__m128i r[16];
+	for ( int x0 = 0; x0 < FRAME_8080_WIDTH; x0 += 16 )
+	{
+		if ( !columns_dirty(dirty, x0, 16) )
+		{
+			continue;
+		}
+		for ( int k0 = 0; k0 < FRAME_8080_COLUMN_BYTES; k0 += 16 )
+		{
+			load_block(vram, x0, k0, r);
+			for ( int j = 0; j < 16; j++ )
+			{
+				for ( int bit = 0; bit < 8; bit++ )
+				{
+					__m128i mask = _mm_set1_epi8(1 << bit);
+					__m128i pixels = _mm_cmpeq_epi8(_mm_and_si128(r[j], mask), mask);
+					_mm_storeu_si128((__m128i *)(out + frame_row(k0 + j, bit) * FRAME_8080_WIDTH + x0), pixels);
+				}
+			}
+		}
+	}
+}
+
+void rgba_sse2(const uint8_t *memory, uint32_t *out, uint32_t fg, uint32_t bg, const uint64_t *dirty)
+{
+	const uint8_t *vram = memory + FRAME_8080_VRAM;
+	const __m128i background = _mm_set1_epi32(bg);
+	const __m128i difference = _mm_set1_epi32(fg ^ bg);
+	__m128i r[16];
+	for ( int x0 = 0; x0 < FRAME_8080_WIDTH; x0 += 16 )
+	{
+		if ( !columns_dirty(dirty, x0, 16) )
+		{
+			continue;
+		}
+		for ( int k0 = 0; k0 < FRAME_8080_COLUMN_BYTES; k0 += 16 )
+		{
+			load_block(vram, x0, k0, r);
+			for ( int j = 0; j < 16; j++ )
+			{
+				for ( int bit = 0; bit < 8; bit++ )
+				{
+					__m128i mask = _mm_set1_epi8(1 << bit);
+					__m128i pixels = _mm_cmpeq_epi8(_mm_and_si128(r[j], mask), mask);
+					// widen each 0/0xff byte to a 0/0xffffffff word
+					__m128i low = _mm_unpacklo_epi8(pixels, pixels);
+					__m128i high = _mm_unpackhi_epi8(pixels, pixels);
+					__m128i words[4] = {
+						_mm_unpacklo_epi16(low, low), _mm_unpackhi_epi16(low, low),
+						_mm_unpacklo_epi16(high, high), _mm_unpackhi_epi16(high, high),
+					};
+					__m128i *dest = (__m128i *)(out + frame_row(k0 + j, bit) * FRAME_8080_WIDTH + x0);
+					for ( int w = 0; w < 4; w++ )
+					{
+						_mm_storeu_si128(dest + w, _mm_xor_si128(background, _mm_and_si128(words[w], difference)));
+					}
+				}
+			}
+		}
+	}
+}
+
+// The AVX2 versions transpose two neighbouring blocks and expand 32
+// columns at a time; 224 columns is exactly 7 of them
+__attribute__((target("avx2"))) void gray_avx2(const uint8_t *memory, uint8_t *out, const uint64_t *dirty)
+{
+	const uint8_t *vram = memory + FRAME_8080_VRAM;
+	__m128i left[16], right[16];
+	for ( int x0 = 0; x0 < FRAME_8080_WIDTH; x0 += 32 )
+	{
+		if ( !columns_dirty(dirty, x0, 32) )
+		{
+			continue;
+		}
+		for ( int k0 = 0; k0 < FRAME_8080_COLUMN_BYTES; k0 += 16 )
+		{
+			load_block(vram, x0, k0, left);
+			load_block(vram, x0 + 16, k0, right);
+			for ( int j = 0; j < 16; j++ )
+			{
+				__m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(left[j]), right[j], 1);
+				for ( int bit = 0; bit < 8; bit++ )
+				{
+					__m256i mask = _mm256_set1_epi8(1 << bit);
+					__m256i pixels = _mm256_cmpeq_epi8(_mm256_and_si256(bytes, mask), mask);
+					_mm256_storeu_si256((__m256i *)(out + frame_row(k0 + j, bit) * FRAME_8080_WIDTH + x0), pixels);
+				}
+			}
+		}
+	}
+}
+
+__attribute__((target("avx2"))) void rgba_avx2(const uint8_t *memory, uint32_t *out, uint32_t fg, uint32_t bg, const uint64_t *dirty)
+{
+	const uint8_t *vram = memory + FRAME_8080_VRAM;
+	const __m256i background = _mm256_set1_epi32(bg);
+	const __m256i difference = _mm256_set1_epi32(fg ^ bg);
+	__m128i r[16];
+	for ( int x0 = 0; x0 < FRAME_8080_WIDTH; x0 += 16 )
+	{
+		if ( !columns_dirty(dirty, x0, 16) )
+		{
+			continue;
+		}
+		for ( int k0 = 0; k0 < FRAME_8080_COLUMN_BYTES; k0 += 16 )
+		{
+			load_block(vram, x0, k0, r);
+			for ( int j = 0; j < 16; j++ )
+			{
+				for ( int bit = 0; bit < 8; bit++ )
+				{
+					__m128i mask = _mm_set1_epi8(1 << bit);
+					__m128i pixels = _mm_cmpeq_epi8(_mm_and_si128(r[j], mask), mask);
+					// sign extension widens each 0/0xff byte to a 0/0xffffffff word
+					__m256i low = _mm256_cvtepi8_epi32(pixels);
+					__m256i high = _mm256_cvtepi8_epi32(_mm_srli_si128(pixels, 8));
+					__m256i *dest = (__m256i *)(out + frame_row(k0 + j, bit) * FRAME_8080_WIDTH + x0);
+					_mm256_storeu_si256(dest, _mm256_xor_si256(background, _mm256_and_si256(low, difference)));
+					_mm256_storeu_si256(dest + 1, _mm256_xor_si256(background, _mm256_and_si256(high, difference)));
+				}
+			}
+		}
+	}
+}
+#endif
+
+static int kernel = -1;
+
+int frame_8080_supported(int which)
+{
+	switch (which)
+	{
+		case FRAME_8080_SCALAR: return 1;
+#ifdef FRAME_8080_X86
+		case FRAME_8080_SSE2: return 1;
+		case FRAME_8080_AVX2: return __builtin_cpu_supports("avx2");
+#endif
+		default: return 0;
+	}
+}
+
+// Returns -1, leaving the current choice alone, if the host can't run 'which'
+int frame_8080_use(int which)
+{
+	if ( !frame_8080_supported(which) )
+	{
+		return -1;
+	}
+	kernel = which;
+	return 0;
+}
+
+int frame_8080_kernel(void)
+{
+	if ( kernel < 0 )
+	{
+		kernel = FRAME_8080_AVX2;
+		while ( !frame_8080_supported(kernel) )
+		{
+			kernel--;
+		}
+	}
+	return kernel;
+}
+
+void frame_8080_gray_update(const uint8_t *memory, uint8_t *out, const uint64_t *dirty)
+{
+	switch (frame_8080_kernel())
+	{
+#ifdef FRAME_8080_X86
+		case FRAME_8080_AVX2: gray_avx2(memory, out, dirty); break;
+		case FRAME_8080_SSE2: gray_sse2(memory, out, dirty); break;
+#endif
+		default: gray_scalar(memory, out, dirty); break;
+	}
+}
+
+void frame_8080_rgba_update(const uint8_t *memory, uint32_t *out, uint32_t fg, uint32_t bg, const uint64_t *dirty)
+{
+	switch (frame_8080_kernel())
+	{
+#ifdef FRAME_8080_X86
+		case FRAME_8080_AVX2: rgba_avx2(memory, out, fg, bg, dirty); break;
+		case FRAME_8080_SSE2: rgba_sse2(memory, out, fg, bg, dirty); break;
+#endif
+		default: rgba_scalar(memory, out, fg, bg, dirty); break;
+	}
+}
+
+void frame_8080_gray(const uint8_t *memory, uint8_t *out)
+{
+	frame_8080_gray_update(memory, out, NULL);
+}
+
+void frame_8080_rgba(const uint8_t *memory, uint32_t *out, uint32_t fg, uint32_t bg)
+{
+	frame_8080_rgba_update(memory, out, fg, bg, NULL);
+}
+
+// 64-bit mix of one column's 32 bytes
+static uint64_t hash_column(const uint8_t *bytes)
+{
+	uint64_t hash = 0x8080;
+	for ( int i = 0; i < FRAME_8080_COLUMN_BYTES; i += 8 )
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof(word));
+		hash = (hash ^ word) * 0x9e3779b97f4a7c15;
+		hash ^= hash >> 29;
+	}
+	return hash;
+}
+
+uint64_t frame_8080_hash(const uint8_t *memory, struct FrameHash8080 *hash, const uint64_t *dirty)
+{
+	const uint8_t *vram = memory + FRAME_8080_VRAM;
+	uint64_t total = 0;
+	for ( int x = 0; x < FRAME_8080_WIDTH; x++ )
+	{
+		if ( columns_dirty(dirty, x, 1) )
+		{
+			hash->columns[x] = hash_column(vram + x * FRAME_8080_COLUMN_BYTES);
+		}
+		total = (total ^ hash->columns[x]) * 0xff51afd7ed558ccd;
+	}
+	return total ^ (total >> 33);
+}
+
+int frame_8080_write_pgm(const uint8_t *memory, const char *path)
+{
+	static uint8_t pixels[FRAME_8080_PIXELS];
+	frame_8080_gray(memory, pixels);
+	FILE *f = fopen(path, "wb");
+	if ( f == NULL )
+	{
+		return -1;
+	}
+	int ok = fprintf(f, "P5\n%d %d\n255\n", FRAME_8080_WIDTH, FRAME_8080_HEIGHT) > 0
+		&& fwrite(pixels, sizeof(pixels), 1, f) == 1;
+	return (fclose(f) == 0 && ok) ? 0 : -1;
+}
@@ -0,0 +1,63 @@
+#ifndef FRAME_8080_H
+#define FRAME_8080_H
+
+#include <stdint.h>
+
+/*
+ * Headless frame export for the Space Invaders video RAM.
+ *
+ * $2400-$3fff holds the 1 bit per pixel bitmap as the monitor scans it:
+ * 224 columns of 32 bytes, the lowest bit of each column's first byte at
+ * the bottom of the screen (the monitor is mounted rotated). The exporters
+ * turn it upright into a FRAME_8080_WIDTH x FRAME_8080_HEIGHT image, row
+ * by row from the top, one pixel per byte (0 or 0xff) or per 32-bit word.
+ */
+#define FRAME_8080_VRAM 0x2400
+#define FRAME_8080_VRAM_SIZE 0x1c00
+#define FRAME_8080_COLUMN_BYTES 32
+#define FRAME_8080_WIDTH 224
+#define FRAME_8080_HEIGHT 256
+#define FRAME_8080_PIXELS (FRAME_8080_WIDTH * FRAME_8080_HEIGHT)
+#define FRAME_8080_COLUMN_SHIFT 5   // log2(FRAME_8080_COLUMN_BYTES)
+
+// Implementations of the conversion; the best one the host supports is
+// used unless frame_8080_use picks another
+#define FRAME_8080_SCALAR 0
+#define FRAME_8080_SSE2 1
+#define FRAME_8080_AVX2 2
+
+int frame_8080_supported(int kernel);
+int frame_8080_use(int kernel);
+int frame_8080_kernel(void);
+
+// 'out' holds FRAME_8080_PIXELS bytes, 0xff for a lit pixel
+void frame_8080_gray(const uint8_t *memory, uint8_t *out);
+
+// 'out' holds FRAME_8080_PIXELS words, each set to fg or bg as given, so
+// the caller picks the byte order (0xffffffff and 0xff000000 are white and
+// black RGBA on a little-endian host)
+void frame_8080_rgba(const uint8_t *memory, uint32_t *out, uint32_t fg, uint32_t bg);
+
+/*
+ * Incremental versions. 'dirty' has one bit per column (i.e. per
+ * FRAME_8080_COLUMN_BYTES of VRAM, as a struct Dirty8080 set up with
+ * FRAME_8080_VRAM, FRAME_8080_VRAM_SIZE and FRAME_8080_COLUMN_SHIFT keeps
+ * them) and only those columns are converted again, so 'out' must still
+ * hold the previous frame. NULL converts everything. The bits are left
+ * alone: clear them once every user of the frame has caught up.
+ */
+void frame_8080_gray_update(const uint8_t *memory, uint8_t *out, const uint64_t *dirty);
+void frame_8080_rgba_update(const uint8_t *memory, uint32_t *out, uint32_t fg, uint32_t bg, const uint64_t *dirty);
+
+// Per-column hashes kept between frames so only dirty columns are rehashed
+struct FrameHash8080 {
+	uint64_t columns[FRAME_8080_WIDTH];
+};
+
+// Returns a 64-bit hash of the whole screen, as for the update functions
+uint64_t frame_8080_hash(const uint8_t *memory, struct FrameHash8080 *hash, const uint64_t *dirty);
+
+// Writes the frame as a binary PGM; returns 0 on success
+int frame_8080_write_pgm(const uint8_t *memory, const char *path);
+
+#endif
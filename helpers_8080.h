@@ -0,0 +1,123 @@
+#ifndef HELPERS_8080_H
+#define HELPERS_8080_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "emulator_8080.h"
+
+/*
+ * Static inline helpers the instruction bodies in opcodes_8080.h call, for
+ * every file that includes those bodies: emulator_8080.c and the C that
+ * recompile_8080 writes.
+ */
+
+// Z, S and P flags of every byte value, in their PUSH PSW bit positions.
+// The preprocessor expands ZSP_256(0) into the 256 table entries.
+#define ZSP_S(v) ((v) & 0x80)
+#define ZSP_Z(v) ((v) == 0 ? 0x40 : 0)
+#define ZSP_P(v) ((((0x6996 >> (((v) ^ ((v) >> 4)) & 0xf)) & 0x1) ^ 0x1) << 2)   // even parity
+#define ZSP(v) (ZSP_S(v) | ZSP_Z(v) | ZSP_P(v))
+#define ZSP_4(v) ZSP(v), ZSP((v) + 1), ZSP((v) + 2), ZSP((v) + 3)
+#define ZSP_16(v) ZSP_4(v), ZSP_4((v) + 4), ZSP_4((v) + 8), ZSP_4((v) + 12)
+#define ZSP_64(v) ZSP_16(v), ZSP_16((v) + 16), ZSP_16((v) + 32), ZSP_16((v) + 48)
+#define ZSP_256(v) ZSP_64(v), ZSP_64((v) + 64), ZSP_64((v) + 128), ZSP_64((v) + 192)
+
+static const uint8_t zsp_table[256] = { ZSP_256(0) };
+
+static inline void set_zsp(struct State8080 *state, uint8_t value)
+{
+	uint8_t zsp = zsp_table[value];
+	state->cf.z = (zsp >> 6) & 0x1;
+	state->cf.s = zsp >> 7;
+	state->cf.p = (zsp >> 2) & 0x1;
+}
+
+// Brings only CY up to date, for instructions that read it or must keep it
+// while they overwrite lazy_result
+static inline void materialize_carry(struct State8080 *state)
+{
+	if ( state->lazy_pending & LAZY_CY )
+	{
+		state->cf.cy = (state->lazy_result >> 8) & 0x1;
+		state->lazy_pending &= ~LAZY_CY;
+	}
+}
+
+// Marks the line holding 'addr' if it is inside the tracked range, empties
+// the decoded instructions that contain it and reports the write if its page
+// is watched
+static inline void touch_8080(struct State8080 *state, uint16_t addr)
+{
+	struct Dirty8080 *dirty = state->dirty;
+	if ( dirty != NULL )
+	{
+		uint16_t offset = addr - dirty->base;
+		if ( offset < dirty->size )
+		{
+			uint16_t line = offset >> dirty->shift;
+			dirty->lines[line >> 6] |= (uint64_t)1 << (line & 63);
+		}
+	}
+	struct Decode8080 *decode = state->decode;
+	if ( decode != NULL )
+	{
+		decode->ops[addr] = (struct DecodedOp8080){ 0 };
+		decode->ops[(uint16_t)(addr - 1)] = (struct DecodedOp8080){ 0 };
+		decode->ops[(uint16_t)(addr - 2)] = (struct DecodedOp8080){ 0 };
+	}
+	struct Watch8080 *watch = state->watch;
+	if ( watch != NULL && watch->pages[addr >> WATCH_8080_PAGE_SHIFT] )
+	{
+		watch->written(watch->ctx, addr);
+	}
+}
+
+// Every guest write goes through here
+static inline void store_8080(struct State8080 *state, uint16_t addr, uint8_t value)
+{
+	state->memory[addr] = value;
+	touch_8080(state, addr);
+}
+
+// 'elapsed' is added to state->cycles for the input log, see ELAPSED_8080
+static inline uint8_t in_8080(struct State8080 *state, uint8_t port, int elapsed)
+{
+	if ( state->replay != NULL )
+	{
+		return replay_8080_in(state, port, state->cycles + elapsed);
+	}
+	if ( state->ports == NULL )
+	{
+		return 0;
+	}
+	return state->ports->in[port](state->ports->ctx, port);
+}
+
+static inline void out_8080(struct State8080 *state, uint8_t port, uint8_t value)
+{
+	if ( state->ports != NULL )
+	{
+		state->ports->out[port](state->ports->ctx, port, value);
+	}
+}
+
+// body_0xNN(state, state_mem, opcode, elapsed) runs the body of opcode 0xNN
+// from opcodes_8080.h and returns the cycles it took beyond cycles_8080[0xNN],
+// for code that runs a known opcode without dispatching on it; 'elapsed' is
+// the caller's ELAPSED_8080
+#define ELAPSED_8080 elapsed
+#define OPCODE(op, ...) \
+	static inline int body_##op(struct State8080 *state, uint8_t *state_mem, const unsigned char *opcode, int elapsed) \
+	{ \
+		(void)state; (void)state_mem; (void)opcode; (void)elapsed; \
+		int cycles = 0; \
+		__VA_ARGS__ \
+		return cycles; \
+	}
+#include "opcodes_8080.h"
+#undef OPCODE
+#undef ELAPSED_8080
+
+#endif
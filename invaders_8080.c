@@ -0,0 +1,222 @@
+#include <string.h>
+
+#include "invaders_8080.h"
+#include "frame_8080.h"
+
+const struct RomPart8080 invaders_rom_set[INVADERS_ROM_PARTS] = {
+	{ "invaders.h", 0x0000 },
+	{ "invaders.g", 0x0800 },
+	{ "invaders.f", 0x1000 },
+	{ "invaders.e", 0x1800 },
+};
+
+// Both video interrupts recur once per frame. If the game has interrupts
+// disabled when one falls due, it is lost, as on the real board.
+void mid_screen_interrupt(struct State8080 *state, void *ctx)
+{
+	struct Invaders8080 *machine = ctx;
+	interrupt_8080(state, 1);
+	schedule_event_8080(&machine->scheduler, (machine->frame + 1) * INVADERS_FRAME_CYCLES + INVADERS_MID_SCREEN_CYCLES, mid_screen_interrupt, machine);
+}
+
+void vblank_interrupt(struct State8080 *state, void *ctx)
+{
+	struct Invaders8080 *machine = ctx;
+	interrupt_8080(state, 2);
+	if ( machine->rewind != NULL )
+	{
+		rewind_8080_mark(machine->rewind, machine->frame, machine->inputs);
+	}
+	machine->frame++;
+	schedule_event_8080(&machine->scheduler, (machine->frame + 1) * INVADERS_FRAME_CYCLES, vblank_interrupt, machine);
+}
+
+/*
+ * The CPU has no barrel shifter, so the board has one: OUT 4 shifts a byte
+ * into the top of a 16-bit register, OUT 2 selects an offset and IN 3 reads
+ * the 8 bits starting that many bits below the top.
+ */
+uint8_t shift_result_in(void *ctx, uint8_t port)
+{
+	struct Invaders8080 *machine = ctx;
+	return (machine->shift >> (8 - machine->shift_offset)) & 0xff;
+}
+
+void shift_offset_out(void *ctx, uint8_t port, uint8_t value)
+{
+	struct Invaders8080 *machine = ctx;
+	machine->shift_offset = value & 0x7;
+}
+
+void shift_data_out(void *ctx, uint8_t port, uint8_t value)
+{
+	struct Invaders8080 *machine = ctx;
+	machine->shift = (value << 8) | (machine->shift >> 8);
+}
+
+uint8_t inputs_in(void *ctx, uint8_t port)
+{
+	struct Invaders8080 *machine = ctx;
+	return machine->inputs[port];
+}
+
+void sound_out(void *ctx, uint8_t port, uint8_t value)
+{
+	struct Invaders8080 *machine = ctx;
+	machine->sound[port == 5] = value;
+}
+
+void invaders_8080_init(struct Invaders8080 *machine, uint8_t *memory)
+{
+	initialize_state(&machine->state, 0, memory);
+	initialize_ports(&machine->ports, machine);
+	for ( int port = 0; port < INVADERS_INPUT_PORTS; port++ )
+	{
+		machine->ports.in[port] = inputs_in;
+	}
+	machine->ports.in[3] = shift_result_in;
+	machine->ports.out[2] = shift_offset_out;
+	machine->ports.out[3] = sound_out;
+	machine->ports.out[4] = shift_data_out;
+	machine->ports.out[5] = sound_out;
+	machine->state.ports = &machine->ports;
+	initialize_dirty(&machine->vram_dirty, FRAME_8080_VRAM, FRAME_8080_VRAM_SIZE, FRAME_8080_COLUMN_SHIFT);
+	machine->state.dirty = &machine->vram_dirty;
+	machine->shift = 0;
+	machine->shift_offset = 0;
+	machine->inputs[0] = 0x0e;  // bits 1-3 always read 1
+	machine->inputs[1] = 0x08;  // bit 3 always reads 1
+	machine->inputs[2] = 0x00;  // 3 ships, extra ship at 1500
+	machine->sound[0] = 0;
+	machine->sound[1] = 0;
+	machine->rewind = NULL;
+	initialize_scheduler(&machine->scheduler);
+	machine->frame = 0;
+	schedule_event_8080(&machine->scheduler, INVADERS_MID_SCREEN_CYCLES, mid_screen_interrupt, machine);
+	schedule_event_8080(&machine->scheduler, INVADERS_FRAME_CYCLES, vblank_interrupt, machine);
+}
+
+void invaders_8080_fork(struct Invaders8080 *child, const struct Invaders8080 *parent, uint8_t *memory)
+{
+	*child = *parent;
+	child->state.memory = memory;
+	child->state.trace = NULL;
+	child->state.profile = NULL;
+	child->state.watch = NULL;
+	child->state.decode = NULL;
+	child->state.jit = NULL;
+	child->state.replay = NULL;
+	child->rewind = NULL;
+	child->state.ports = &child->ports;
+	child->state.dirty = &child->vram_dirty;
+	child->ports.ctx = child;
+	child->scheduler.run = run_for_cycles_8080;
+	for ( int i = 0; i < child->scheduler.count; i++ )
+	{
+		child->scheduler.events[i].ctx = child;
+	}
+}
+
+int invaders_8080_snapshot(struct Invaders8080 *machine, uint8_t *buffer, int size)
+{
+	if ( size < INVADERS_SNAPSHOT_SIZE || snapshot_8080(&machine->state, buffer, size) < 0 )
+	{
+		return -1;
+	}
+	uint8_t *board = &buffer[SNAPSHOT_8080_SIZE];
+	memset(board, 0, INVADERS_SNAPSHOT_SIZE - SNAPSHOT_8080_SIZE);
+	memcpy(board, "SINV", 4);
+	board[4] = INVADERS_SNAPSHOT_VERSION;
+	put_le_8080(&board[5], machine->frame, 8);
+	put_le_8080(&board[13], machine->shift, 2);
+	board[15] = machine->shift_offset;
+	memcpy(&board[16], machine->inputs, INVADERS_INPUT_PORTS);
+	memcpy(&board[19], machine->sound, 2);
+	board[21] = machine->scheduler.count;
+	for ( int i = 0; i < machine->scheduler.count; i++ )
+	{
+		struct Event8080 *event = &machine->scheduler.events[i];
+		if ( event->fire == mid_screen_interrupt )
+		{
+			board[22 + 9 * i] = 1;
+		}
+		else if ( event->fire == vblank_interrupt )
+		{
+			board[22 + 9 * i] = 2;
+		}
+		else
+		{
+			return -1;
+		}
+		put_le_8080(&board[23 + 9 * i], event->when, 8);
+	}
+	return INVADERS_SNAPSHOT_SIZE;
+}
+
+int invaders_8080_restore(struct Invaders8080 *machine, const uint8_t *buffer, int size)
+{
+	if ( size < INVADERS_SNAPSHOT_SIZE )
+	{
+		return -1;
+	}
+	const uint8_t *board = &buffer[SNAPSHOT_8080_SIZE];
+	if ( memcmp(board, "SINV", 4) != 0 || board[4] != INVADERS_SNAPSHOT_VERSION || board[21] > MAX_EVENTS_8080 )
+	{
+		return -1;
+	}
+	if ( restore_8080(&machine->state, buffer, size) < 0 )
+	{
+		return -1;
+	}
+	machine->frame = get_le_8080(&board[5], 8);
+	machine->shift = get_le_8080(&board[13], 2);
+	machine->shift_offset = board[15];
+	memcpy(machine->inputs, &board[16], INVADERS_INPUT_PORTS);
+	memcpy(machine->sound, &board[19], 2);
+	machine->scheduler.count = 0;
+	for ( int i = 0; i < board[21]; i++ )
+	{
+		uint64_t when = get_le_8080(&board[23 + 9 * i], 8);
+		schedule_event_8080(&machine->scheduler, when, board[22 + 9 * i] == 1 ? mid_screen_interrupt : vblank_interrupt, machine);
+	}
+	return INVADERS_SNAPSHOT_SIZE;
+}
+
+int invaders_8080_rewind_save(struct Invaders8080 *machine, struct Rewind8080 *rewind)
+{
+	if ( rewind->blob_size != INVADERS_SNAPSHOT_SIZE || rewind->mark_size != INVADERS_INPUT_PORTS
+		|| invaders_8080_snapshot(machine, rewind->work, rewind->blob_size) < 0 )
+	{
+		return -1;
+	}
+	machine->rewind = rewind;
+	return rewind_8080_push(rewind, rewind->work, machine->frame);
+}
+
+long long invaders_8080_rewind(struct Invaders8080 *machine, struct Rewind8080 *rewind, uint64_t frame)
+{
+	uint64_t found;
+	if ( rewind->blob_size != INVADERS_SNAPSHOT_SIZE || rewind_8080_seek(rewind, frame, rewind->work, &found) < 0 )
+	{
+		return -1;
+	}
+	if ( invaders_8080_restore(machine, rewind->work, rewind->blob_size) < 0 )
+	{
+		return -1;
+	}
+	// frame n begins at the vblank at cycle n * INVADERS_FRAME_CYCLES; the
+	// frames run again are already marked
+	struct Rewind8080 *marking = machine->rewind;
+	machine->rewind = NULL;
+	while ( machine->frame < frame )
+	{
+		const uint8_t *inputs = rewind_8080_marked(rewind, machine->frame);
+		if ( inputs != NULL )
+		{
+			memcpy(machine->inputs, inputs, INVADERS_INPUT_PORTS);
+		}
+		run_scheduled_8080(&machine->state, &machine->scheduler, (machine->frame + 1) * INVADERS_FRAME_CYCLES - machine->state.cycles);
+	}
+	machine->rewind = marking;
+	return machine->frame;
+}
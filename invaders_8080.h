@@ -0,0 +1,82 @@
+#ifndef INVADERS_8080_H
+#define INVADERS_8080_H
+
+#include "emulator_8080.h"
+
+// Space Invaders ROM set: four 2 KiB images filling $0000-$1fff
+#define INVADERS_ROM_PARTS 4
+extern const struct RomPart8080 invaders_rom_set[INVADERS_ROM_PARTS];
+
+// The 2 MHz CPU draws a 60 Hz frame every 33333 cycles. The video hardware
+// raises RST 1 when the beam reaches the middle of the screen and RST 2 at
+// the start of vertical blank.
+#define INVADERS_CLOCK 2000000
+#define INVADERS_FRAME_CYCLES (INVADERS_CLOCK / 60)
+#define INVADERS_MID_SCREEN_CYCLES (INVADERS_FRAME_CYCLES / 2)
+
+/*
+ * I/O ports of the board:
+ *   IN 0-2   switches and buttons (inputs[], set by the host)
+ *   IN 3     shift register result
+ *   OUT 2    shift amount (bits 0-2)
+ *   OUT 3,5  sound triggers (kept in sound[])
+ *   OUT 4    shift register data: the new byte goes in at the top
+ *   OUT 6    watchdog
+ */
+#define INVADERS_INPUT_PORTS 3
+
+struct Invaders8080 {
+	struct State8080 state;
+	struct Scheduler8080 scheduler;
+	struct Ports8080 ports;
+	struct Dirty8080 vram_dirty;  // one line per screen column, see frame_8080.h
+	uint64_t frame;             // frames completed, i.e. vblanks so far
+	uint16_t shift;             // external bit-shift register, last two bytes written
+	uint8_t shift_offset;
+	uint8_t inputs[INVADERS_INPUT_PORTS];
+	uint8_t sound[2];
+	struct Rewind8080 *rewind;  // history that each vblank marks with the inputs of the frame
+};
+
+// Resets the CPU and schedules the first pair of video interrupts
+void invaders_8080_init(struct Invaders8080 *machine, uint8_t *memory);
+
+// Makes 'child' a copy of 'parent' running on 'memory', which must hold the
+// same bytes (e.g. from fork_8080_memory). The child starts without the
+// parent's trace, profile, decode cache, translator, input log and rewind
+// history, and interprets.
+void invaders_8080_fork(struct Invaders8080 *child, const struct Invaders8080 *parent, uint8_t *memory);
+
+/*
+ * A machine snapshot is the CPU snapshot (snapshot_8080) followed by the
+ * board:
+ *
+ *   0   "SINV" and INVADERS_SNAPSHOT_VERSION
+ *   5   frame (64 bit), shift (16 bit), shift_offset, inputs[], sound[]
+ *   21  number of pending video interrupts, then for each of
+ *       MAX_EVENTS_8080 slots its RST number and when it is due (64 bit)
+ */
+#define INVADERS_SNAPSHOT_VERSION 1
+#define INVADERS_SNAPSHOT_SIZE (SNAPSHOT_8080_SIZE + 22 + 9 * MAX_EVENTS_8080)
+
+// Returns the bytes written, or -1 if 'size' is too small or the scheduler
+// holds an event that is not one of the board's interrupts
+int invaders_8080_snapshot(struct Invaders8080 *machine, uint8_t *buffer, int size);
+// Returns the bytes read, or -1 if the buffer holds no machine snapshot of
+// this version; the machine must have been set up by invaders_8080_init,
+// and keeps its memory buffer, attachments and scheduler->run
+int invaders_8080_restore(struct Invaders8080 *machine, const uint8_t *buffer, int size);
+
+// Adds the machine, tagged with its frame count, to a history made with
+// blob_size INVADERS_SNAPSHOT_SIZE and mark_size INVADERS_INPUT_PORTS; the
+// host calls it every few frames. From then on every frame's inputs are
+// marked in the history too. Returns -1 if out of memory.
+int invaders_8080_rewind_save(struct Invaders8080 *machine, struct Rewind8080 *rewind);
+// Takes the machine back to where it was when 'frame' began, by restoring
+// the newest saved state before it and running forward with the inputs
+// marked for each frame in between, so exactly as before when the host
+// changes inputs between frames. Returns the frame reached, which is later
+// when 'frame' is older than the history, or -1 if nothing was saved.
+long long invaders_8080_rewind(struct Invaders8080 *machine, struct Rewind8080 *rewind, uint64_t frame);
+
+#endif
@@ -0,0 +1,1000 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "jit_8080.h"
+
+#if defined(__x86_64__)
+// Room kept free for one block and its stubs; no block gets near it
+#define JIT_8080_BLOCK_BYTES 32768
+
+static void load_regs(struct Jit8080 *jit, struct State8080 *state)
+{
+	jit->regs.a = state->a;
+	jit->regs.f = psw_8080(state);
+	jit->regs.b = state->b;
+	jit->regs.c = state->c;
+	jit->regs.d = state->d;
+	jit->regs.e = state->e;
+	jit->regs.h = state->h;
+	jit->regs.l = state->l;
+	jit->regs.sp = state->sp;
+	jit->regs.pc = state->pc;
+	jit->regs.int_enable = state->int_enable;
+}
+
+static void store_regs(struct Jit8080 *jit, struct State8080 *state)
+{
+	uint8_t f = jit->regs.f;
+	state->a = jit->regs.a;
+	state->cf.cy = f & 0x1;
+	state->cf.p = (f >> 2) & 0x1;
+	state->cf.ac = (f >> 4) & 0x1;
+	state->cf.z = (f >> 6) & 0x1;
+	state->cf.s = (f >> 7) & 0x1;
+	state->lazy_pending = 0;
+	state->b = jit->regs.b;
+	state->c = jit->regs.c;
+	state->d = jit->regs.d;
+	state->e = jit->regs.e;
+	state->h = jit->regs.h;
+	state->l = jit->regs.l;
+	state->sp = jit->regs.sp;
+	state->pc = jit->regs.pc;
+	state->int_enable = jit->regs.int_enable;
+}
+
+// Stores from translated code go through write_8080 for pages that are
+// watched (translated code came from them) or dirty-tracked
+static void set_slow_pages(struct Jit8080 *jit)
+{
+	struct Dirty8080 *dirty = jit->dirty;
+	for ( int page = 0; page < WATCH_8080_PAGES; page++ )
+	{
+		jit->slow[page] = jit->watch.pages[page];
+		if ( dirty != NULL )
+		{
+			int first = dirty->base >> WATCH_8080_PAGE_SHIFT;
+			int last = (dirty->base + dirty->size - 1) >> WATCH_8080_PAGE_SHIFT;
+			if ( page >= first && page <= last )
+			{
+				jit->slow[page] = 1;
+			}
+		}
+	}
+}
+
+void jit_8080_flush(struct Jit8080 *jit)
+{
+	memset(jit->blocks, 0, sizeof(jit->blocks));
+	memset(jit->hits, 0, sizeof(jit->hits));
+	memset(jit->watch.pages, 0, sizeof(jit->watch.pages));
+	set_slow_pages(jit);
+	jit->patch_count = 0;
+	jit->code_next = jit->code_start;
+	jit->flush_count++;
+}
+
+// Watch callback: the guest wrote to a page translated code came from
+static void jit_written(void *ctx, uint16_t addr)
+{
+	struct Jit8080 *jit = ctx;
+	uint8_t page = addr >> WATCH_8080_PAGE_SHIFT;
+	if ( jit->flushes[page] < JIT_8080_PAGE_FLUSHES )
+	{
+		jit->flushes[page]++;
+	}
+	jit->modified = 1;
+	jit_8080_flush(jit);
+}
+
+/*
+ * Helpers called from translated code (System V calling convention). A
+ * store returns nonzero when it hit translated code, after which the block
+ * finishes the instruction and returns.
+ */
+static uint32_t jit_store(struct Jit8080 *jit, uint32_t addr, uint32_t value)
+{
+	write_8080(jit->state, addr, value);
+	uint32_t modified = jit->modified;
+	jit->modified = 0;
+	return modified;
+}
+
+// 'elapsed' is the cycles run since entering, up to the IN
+static uint32_t jit_in(struct Jit8080 *jit, uint32_t port, uint32_t elapsed)
+{
+	if ( jit->state->replay != NULL )
+	{
+		return replay_8080_in(jit->state, port, jit->state->cycles + elapsed);
+	}
+	struct Ports8080 *ports = jit->state->ports;
+	return ports != NULL ? ports->in[port](ports->ctx, port) : 0;
+}
+
+static uint32_t jit_out(struct Jit8080 *jit, uint32_t port, uint32_t value)
+{
+	struct Ports8080 *ports = jit->state->ports;
+	if ( ports != NULL )
+	{
+		ports->out[port](ports->ctx, port, value);
+	}
+	return 0;
+}
+
+/*
+ * Host registers while a block runs:
+ *   al A, ah flags, cx BC, dx DE, bx HL, bp SP (upper bits zero)
+ *   rsi guest memory, rdi guest address being accessed
+ *   r14 struct Jit8080, r15d cycles run since entering
+ *   r11d set when a store hit translated code
+ *   r8-r10 scratch
+ * Guest registers use the legacy byte registers (ch, dh, bh, ah), which
+ * can't be encoded with a REX prefix, so guest memory is addressed as
+ * [rsi + rdi] rather than through r8-r15.
+ */
+
+// Host byte register of each 8080 register field (B C D E H L M A)
+static const uint8_t host8[8] = { 5, 1, 6, 2, 7, 3, 0xff, 0 };     // ch cl dh dl bh bl - al
+#define HOST_AH 4
+// Host word register of each register pair (BC DE HL SP)
+static const uint8_t host16[4] = { 1, 2, 3, 5 };                    // cx dx bx bp
+
+// x86 ALU opcodes in 8080 group order (ADD ADC SUB SBB ANA XRA ORA CMP)
+static const uint8_t alu_rm[8] = { 0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38 };
+static const uint8_t alu_imm[8] = { 0x04, 0x14, 0x2c, 0x1c, 0x24, 0x34, 0x0c, 0x3c };
+
+// Flag bit tested by each condition (NZ Z NC C PO PE P M), two per flag
+static const uint8_t condition_mask[4] = { 0x40, 0x01, 0x04, 0x80 };
+
+#define VALUE_R8 0x100              // store r8b
+#define VALUE_IMM 0x200             // store the immediate in the low byte
+
+#define STUB_STORE 0
+#define STUB_EXIT 1
+#define STUB_EXIT_MODIFIED 2
+#define MAX_STUBS (JIT_8080_BLOCK_INSTRUCTIONS * 4)
+
+// Out-of-line code emitted after the block body
+struct Stub {
+	int kind;
+	uint8_t *site;              // rel32 of the branch to the stub
+	uint8_t *resume;            // STUB_STORE: where to continue
+	int value;                  // STUB_STORE: what to store
+	uint16_t pc;                // exits: next guest instruction
+	int cycles;                 // exits: cycles run by the block up to there
+};
+
+struct JitBlock8080 {
+	struct Jit8080 *jit;
+	uint8_t *p;
+	int stores;                 // stores emitted for the current instruction
+	int stub_count;
+	struct Stub stubs[MAX_STUBS];
+};
+
+#define EMIT(b, ...) emit_bytes((b), (const uint8_t[]){ __VA_ARGS__ }, sizeof((const uint8_t[]){ __VA_ARGS__ }))
+#define OFFSET(field) ((uint32_t)offsetof(struct Jit8080, field))
+
+static void emit_bytes(struct JitBlock8080 *b, const uint8_t *bytes, size_t count)
+{
+	memcpy(b->p, bytes, count);
+	b->p += count;
+}
+
+static void emit16(struct JitBlock8080 *b, uint16_t value)
+{
+	memcpy(b->p, &value, 2);
+	b->p += 2;
+}
+
+static void emit32(struct JitBlock8080 *b, uint32_t value)
+{
+	memcpy(b->p, &value, 4);
+	b->p += 4;
+}
+
+static void emit64(struct JitBlock8080 *b, uint64_t value)
+{
+	memcpy(b->p, &value, 8);
+	b->p += 8;
+}
+
+// Points the rel32 at 'site' to 'target'
+static void patch(uint8_t *site, uint8_t *target)
+{
+	int32_t rel = (int32_t)(target - (site + 4));
+	memcpy(site, &rel, 4);
+}
+
+// Emits a rel32 to be filled in by patch; returns where it is
+static uint8_t *emit_rel32(struct JitBlock8080 *b)
+{
+	uint8_t *site = b->p;
+	emit32(b, 0);
+	return site;
+}
+
+static struct Stub *add_stub(struct JitBlock8080 *b, int kind, uint8_t *site)
+{
+	struct Stub *stub = &b->stubs[b->stub_count++];
+	stub->kind = kind;
+	stub->site = site;
+	return stub;
+}
+
+// movzx edi, <word register>
+static void emit_address_pair(struct JitBlock8080 *b, int host)
+{
+	EMIT(b, 0x0f, 0xb7, 0xf8 | host);
+}
+
+// Moves SP down a byte and addresses it
+static void emit_push_address(struct JitBlock8080 *b)
+{
+	EMIT(b, 0x66, 0xff, 0xcd);          // dec bp
+	emit_address_pair(b, 5);
+}
+
+static void emit_push_regs(struct JitBlock8080 *b)
+{
+	// push rax, rcx, rdx, rsi, rdi, r8, r9, r10, r11 and keep rsp 16-byte aligned
+	EMIT(b, 0x50, 0x51, 0x52, 0x56, 0x57, 0x41, 0x50, 0x41, 0x51, 0x41, 0x52, 0x41, 0x53);
+	EMIT(b, 0x48, 0x83, 0xec, 0x08);
+}
+
+static void emit_pop_regs(struct JitBlock8080 *b, int merge_modified)
+{
+	EMIT(b, 0x48, 0x83, 0xc4, 0x08);
+	EMIT(b, 0x41, 0x5b);                // pop r11
+	if ( merge_modified )
+	{
+		EMIT(b, 0x41, 0x09, 0xc3);      // or r11d, eax
+	}
+	EMIT(b, 0x41, 0x5a, 0x41, 0x59, 0x41, 0x58, 0x5f, 0x5e, 0x5a, 0x59, 0x58);
+}
+
+// Calls fn(jit, esi, edx); the caller saves whatever it needs across it
+static void emit_call(struct JitBlock8080 *b, void *fn)
+{
+	EMIT(b, 0x4c, 0x89, 0xf7);          // mov rdi, r14
+	EMIT(b, 0x48, 0xb8);                // mov rax, fn
+	emit64(b, (uint64_t)(uintptr_t)fn);
+	EMIT(b, 0xff, 0xd0);                // call rax
+}
+
+// Stores 'value' (a host byte register, VALUE_R8 or VALUE_IMM | byte) at
+// guest address edi. Pages in jit->slow take the write_8080 path.
+static void emit_store(struct JitBlock8080 *b, int value)
+{
+	EMIT(b, 0x41, 0x89, 0xfa);          // mov r10d, edi
+	EMIT(b, 0x41, 0xc1, 0xea, 0x08);    // shr r10d, 8
+	EMIT(b, 0x43, 0x80, 0xbc, 0x16);    // cmp byte [r14 + r10 + slow], 0
+	emit32(b, OFFSET(slow));
+	EMIT(b, 0x00);
+	EMIT(b, 0x0f, 0x85);                // jne stub
+	struct Stub *stub = add_stub(b, STUB_STORE, emit_rel32(b));
+	if ( value & VALUE_IMM )
+	{
+		EMIT(b, 0xc6, 0x04, 0x3e, value & 0xff);
+	}
+	else if ( value == VALUE_R8 )
+	{
+		EMIT(b, 0x44, 0x88, 0x04, 0x3e);
+	}
+	else
+	{
+		EMIT(b, 0x88, (value << 3) | 0x04, 0x3e);
+	}
+	stub->resume = b->p;
+	stub->value = value;
+	b->stores++;
+}
+
+static void emit_store_stub(struct JitBlock8080 *b, struct Stub *stub)
+{
+	emit_push_regs(b);
+	if ( stub->value & VALUE_IMM )
+	{
+		EMIT(b, 0xba);                  // mov edx, imm32
+		emit32(b, stub->value & 0xff);
+	}
+	else if ( stub->value == VALUE_R8 )
+	{
+		EMIT(b, 0x41, 0x0f, 0xb6, 0xd0);    // movzx edx, r8b
+	}
+	else
+	{
+		EMIT(b, 0x0f, 0xb6, 0xd0 | stub->value);    // movzx edx, reg
+	}
+	EMIT(b, 0x89, 0xfe);                // mov esi, edi
+	emit_call(b, jit_store);
+	emit_pop_regs(b, 1);
+	EMIT(b, 0xe9);
+	patch(emit_rel32(b), stub->resume);
+}
+
+// Leaves the block for guest address 'pc' after 'cycles'. Unless the block
+// just wrote to translated code, it jumps straight into the translation of
+// 'pc' (once there is one) when the budget allows.
+static void emit_exit(struct JitBlock8080 *b, uint16_t pc, int cycles, int chain)
+{
+	struct Jit8080 *jit = b->jit;
+	EMIT(b, 0x41, 0x81, 0xc7);          // add r15d, cycles
+	emit32(b, cycles);
+	EMIT(b, 0x66, 0x41, 0xc7, 0x86);    // mov word [r14 + regs.pc], pc
+	emit32(b, OFFSET(regs.pc));
+	emit16(b, pc);
+	if ( chain )
+	{
+		EMIT(b, 0x45, 0x3b, 0xbe);      // cmp r15d, [r14 + chain_limit]
+		emit32(b, OFFSET(chain_limit));
+		EMIT(b, 0x0f, 0x8f);            // jg exit
+		patch(emit_rel32(b), jit->exit);
+		EMIT(b, 0xe9);                  // jmp exit, or the translation of pc
+		uint8_t *site = emit_rel32(b);
+		if ( jit->blocks[pc] != NULL )
+		{
+			patch(site, jit->blocks[pc]);
+		}
+		else
+		{
+			patch(site, jit->exit);
+			if ( jit->patch_count < JIT_8080_PATCHES )
+			{
+				jit->patches[jit->patch_count].target = pc;
+				jit->patches[jit->patch_count].site = (int32_t *)site;
+				jit->patch_count++;
+			}
+		}
+	}
+	else
+	{
+		EMIT(b, 0xe9);
+		patch(emit_rel32(b), jit->exit);
+	}
+}
+
+// Leaves the block for the guest address in r8d (RET, PCHL)
+static void emit_exit_dynamic(struct JitBlock8080 *b, int cycles)
+{
+	struct Jit8080 *jit = b->jit;
+	EMIT(b, 0x66, 0x45, 0x89, 0x86);    // mov [r14 + regs.pc], r8w
+	emit32(b, OFFSET(regs.pc));
+	EMIT(b, 0x41, 0x81, 0xc7);          // add r15d, cycles
+	emit32(b, cycles);
+	EMIT(b, 0x45, 0x3b, 0xbe);          // cmp r15d, [r14 + chain_limit]
+	emit32(b, OFFSET(chain_limit));
+	EMIT(b, 0x0f, 0x8f);                // jg exit
+	patch(emit_rel32(b), jit->exit);
+	EMIT(b, 0x4f, 0x8b, 0x8c, 0xc6);    // mov r9, [r14 + r8 * 8 + blocks]
+	emit32(b, OFFSET(blocks));
+	EMIT(b, 0x4d, 0x85, 0xc9);          // test r9, r9
+	EMIT(b, 0x0f, 0x84);                // jz exit
+	patch(emit_rel32(b), jit->exit);
+	EMIT(b, 0x41, 0xff, 0xe1);          // jmp r9
+}
+
+// Branches to an exit stub when condition 'cond' does not hold
+static void emit_unless(struct JitBlock8080 *b, int cond, uint16_t pc, int cycles)
+{
+	EMIT(b, 0xf6, 0xc4, condition_mask[cond >> 1]);     // test ah, mask
+	// cond & 1 means the flag must be set, so leave when it is clear
+	EMIT(b, 0x0f, (cond & 0x1) ? 0x84 : 0x85);
+	struct Stub *stub = add_stub(b, STUB_EXIT, emit_rel32(b));
+	stub->pc = pc;
+	stub->cycles = cycles;
+}
+
+// Returns to the interpreter at 'pc' if a store of the instruction just
+// emitted hit translated code, which may include what comes next
+static void emit_modified_check(struct JitBlock8080 *b, uint16_t pc, int cycles)
+{
+	EMIT(b, 0x45, 0x85, 0xdb);          // test r11d, r11d
+	EMIT(b, 0x0f, 0x85);                // jnz stub
+	struct Stub *stub = add_stub(b, STUB_EXIT_MODIFIED, emit_rel32(b));
+	stub->pc = pc;
+	stub->cycles = cycles;
+}
+
+// Pushes a 16-bit constant, as CALL and RST do, before jumping to 'pc'
+static void emit_push_constant(struct JitBlock8080 *b, uint16_t value, uint16_t pc, int cycles)
+{
+	emit_push_address(b);
+	emit_store(b, VALUE_IMM | (value >> 8));
+	emit_push_address(b);
+	emit_store(b, VALUE_IMM | (value & 0xff));
+	emit_modified_check(b, pc, cycles);
+}
+
+// Pops a 16-bit value into r8d, as RET does
+static void emit_pop_r8(struct JitBlock8080 *b)
+{
+	emit_address_pair(b, 5);
+	EMIT(b, 0x44, 0x0f, 0xb6, 0x04, 0x3e);  // movzx r8d, byte [rsi + rdi]
+	EMIT(b, 0x66, 0xff, 0xc7);              // inc di
+	EMIT(b, 0x44, 0x0f, 0xb6, 0x0c, 0x3e);  // movzx r9d, byte [rsi + rdi]
+	EMIT(b, 0x41, 0xc1, 0xe1, 0x08);        // shl r9d, 8
+	EMIT(b, 0x45, 0x09, 0xc8);              // or r8d, r9d
+	EMIT(b, 0x66, 0x83, 0xc5, 0x02);        // add bp, 2
+}
+
+static void emit_alu(struct JitBlock8080 *b, int group, int source, int immediate)
+{
+	if ( group == 1 || group == 3 )
+	{
+		EMIT(b, 0x9e);                  // sahf: ADC and SBB read CY
+	}
+	if ( group == 4 && !immediate )
+	{
+		EMIT(b, 0x41, 0x89, 0xc0);      // mov r8d, eax: ANA keeps AC
+	}
+	if ( immediate )
+	{
+		EMIT(b, alu_imm[group], source);
+	}
+	else if ( source == 6 )
+	{
+		emit_address_pair(b, 3);
+		EMIT(b, alu_rm[group] + 2, 0x04, 0x3e);     // op al, [rsi + rdi]
+	}
+	else
+	{
+		EMIT(b, alu_rm[group], 0xc0 | (host8[source] << 3));   // op al, reg
+	}
+	EMIT(b, 0x9f);                      // lahf
+	if ( group >= 4 && group <= 6 )
+	{
+		EMIT(b, 0x80, 0xe4, 0xef);      // and ah, ~AC: x86 leaves AF undefined
+	}
+	if ( group == 4 && !immediate )
+	{
+		EMIT(b, 0x41, 0x81, 0xe0, 0x00, 0x10, 0x00, 0x00);  // and r8d, AC << 8
+		EMIT(b, 0x44, 0x09, 0xc0);                          // or eax, r8d
+	}
+}
+
+static int instruction_length(uint8_t op)
+{
+	switch (op)
+	{
+		case 0x01: case 0x11: case 0x21: case 0x31:
+		case 0x22: case 0x2a: case 0x32: case 0x3a:
+		case 0xc2: case 0xc3: case 0xc4: case 0xca: case 0xcc: case 0xcd:
+		case 0xd2: case 0xd4: case 0xda: case 0xdc:
+		case 0xe2: case 0xe4: case 0xea: case 0xec:
+		case 0xf2: case 0xf4: case 0xfa: case 0xfc:
+			return 3;
+		case 0x06: case 0x0e: case 0x16: case 0x1e: case 0x26: case 0x2e: case 0x36: case 0x3e:
+		case 0xc6: case 0xce: case 0xd6: case 0xde: case 0xe6: case 0xee: case 0xf6: case 0xfe:
+		case 0xd3: case 0xdb:
+			return 2;
+		default:
+			return 1;
+	}
+}
+
+// Cycles an instruction can take at most
+static int instruction_cycles(uint8_t op)
+{
+	// conditional CALL and RET take 6 more when taken
+	if ( (op & 0xc7) == 0xc4 || (op & 0xc7) == 0xc0 )
+	{
+		return cycles_8080[op] + 6;
+	}
+	return cycles_8080[op];
+}
+
+#define TRANSLATE_NO 0              // left to the interpreter
+#define TRANSLATE_NEXT 1            // falls through to the next instruction
+#define TRANSLATE_END 2             // emitted its own exits
+
+// Emits one instruction; 'cycles' is what the block has run before it
+static int translate_instruction(struct JitBlock8080 *b, uint16_t pc, const uint8_t *code, int cycles)
+{
+	uint8_t op = code[0];
+	uint16_t next = pc + instruction_length(op);
+	uint16_t addr = code[1] | (code[2] << 8);
+	int cost = cycles_8080[op];
+
+	// MOV r,r / MOV r,M / MOV M,r
+	if ( op >= 0x40 && op < 0x80 && op != 0x76 )
+	{
+		int dst = (op >> 3) & 0x7;
+		int src = op & 0x7;
+		if ( src == 6 )
+		{
+			emit_address_pair(b, 3);
+			EMIT(b, 0x8a, (host8[dst] << 3) | 0x04, 0x3e);
+		}
+		else if ( dst == 6 )
+		{
+			emit_address_pair(b, 3);
+			emit_store(b, host8[src]);
+		}
+		else if ( dst != src )
+		{
+			EMIT(b, 0x88, 0xc0 | (host8[src] << 3) | host8[dst]);
+		}
+		return TRANSLATE_NEXT;
+	}
+	// ALU r / ALU M
+	if ( op >= 0x80 && op < 0xc0 )
+	{
+		emit_alu(b, (op >> 3) & 0x7, op & 0x7, 0);
+		return TRANSLATE_NEXT;
+	}
+	// ALU data
+	if ( (op & 0xc7) == 0xc6 )
+	{
+		emit_alu(b, (op >> 3) & 0x7, code[1], 1);
+		return TRANSLATE_NEXT;
+	}
+	// MVI r,data / MVI M,data
+	if ( (op & 0xc7) == 0x06 )
+	{
+		int dst = (op >> 3) & 0x7;
+		if ( dst == 6 )
+		{
+			emit_address_pair(b, 3);
+			emit_store(b, VALUE_IMM | code[1]);
+		}
+		else
+		{
+			EMIT(b, 0xb0 + host8[dst], code[1]);
+		}
+		return TRANSLATE_NEXT;
+	}
+	// INR / DCR: x86 INC and DEC keep CF like the 8080 keeps CY
+	if ( (op & 0xc6) == 0x04 && op < 0x40 )
+	{
+		int reg = (op >> 3) & 0x7;
+		int modrm = (op & 0x1) ? 0xc8 : 0xc0;
+		if ( reg == 6 )
+		{
+			emit_address_pair(b, 3);
+			EMIT(b, 0x44, 0x0f, 0xb6, 0x04, 0x3e);  // movzx r8d, byte [rsi + rdi]
+			EMIT(b, 0x9e, 0x41, 0xfe, modrm, 0x9f); // sahf; inc/dec r8b; lahf
+			emit_store(b, VALUE_R8);
+		}
+		else
+		{
+			EMIT(b, 0x9e, 0xfe, modrm | host8[reg], 0x9f);
+		}
+		return TRANSLATE_NEXT;
+	}
+	// conditional JMP / CALL / RET
+	if ( (op & 0xc7) == 0xc2 || (op & 0xc7) == 0xc4 || (op & 0xc7) == 0xc0 )
+	{
+		int cond = (op >> 3) & 0x7;
+		emit_unless(b, cond, next, cycles + cost);
+		if ( (op & 0xc7) == 0xc2 )
+		{
+			emit_exit(b, addr, cycles + cost, 1);
+		}
+		else if ( (op & 0xc7) == 0xc4 )
+		{
+			emit_push_constant(b, next, addr, cycles + cost + 6);
+			emit_exit(b, addr, cycles + cost + 6, 1);
+		}
+		else
+		{
+			emit_pop_r8(b);
+			emit_exit_dynamic(b, cycles + cost + 6);
+		}
+		return TRANSLATE_END;
+	}
+	// RST n
+	if ( (op & 0xc7) == 0xc7 )
+	{
+		emit_push_constant(b, next, op & 0x38, cycles + cost);
+		emit_exit(b, op & 0x38, cycles + cost, 1);
+		return TRANSLATE_END;
+	}
+
+	switch (op)
+	{
+		case 0x00:                      // NOP
+			return TRANSLATE_NEXT;
+		case 0x01: case 0x11: case 0x21:    // LXI B/D/H
+			EMIT(b, 0x66, 0xb8 + host16[op >> 4]);
+			emit16(b, addr);
+			return TRANSLATE_NEXT;
+		case 0x31:                      // LXI SP
+			EMIT(b, 0xbd);
+			emit32(b, addr);
+			return TRANSLATE_NEXT;
+		case 0x03: case 0x13: case 0x23: case 0x33:     // INX
+			EMIT(b, 0x66, 0xff, 0xc0 | host16[op >> 4]);
+			return TRANSLATE_NEXT;
+		case 0x0b: case 0x1b: case 0x2b: case 0x3b:     // DCX
+			EMIT(b, 0x66, 0xff, 0xc8 | host16[op >> 4]);
+			return TRANSLATE_NEXT;
+		case 0x09: case 0x19: case 0x29: case 0x39:     // DAD: only CY changes
+			EMIT(b, 0x41, 0x89, 0xc0);                  // mov r8d, eax
+			EMIT(b, 0x66, 0x01, 0xc3 | (host16[op >> 4] << 3));    // add bx, rp
+			EMIT(b, 0x9f);                              // lahf
+			EMIT(b, 0x41, 0x81, 0xe0, 0x00, 0xfe, 0x00, 0x00);  // and r8d, 0xfe00
+			EMIT(b, 0x25, 0xff, 0x01, 0xff, 0xff);      // and eax, 0xffff01ff
+			EMIT(b, 0x44, 0x09, 0xc0);                  // or eax, r8d
+			return TRANSLATE_NEXT;
+		case 0x02: case 0x12:           // STAX
+			emit_address_pair(b, host16[op >> 4]);
+			emit_store(b, 0);
+			return TRANSLATE_NEXT;
+		case 0x0a: case 0x1a:           // LDAX
+			emit_address_pair(b, host16[op >> 4]);
+			EMIT(b, 0x8a, 0x04, 0x3e);
+			return TRANSLATE_NEXT;
+		case 0x32:                      // STA
+			EMIT(b, 0xbf);
+			emit32(b, addr);
+			emit_store(b, 0);
+			return TRANSLATE_NEXT;
+		case 0x3a:                      // LDA
+			EMIT(b, 0x8a, 0x86);
+			emit32(b, addr);
+			return TRANSLATE_NEXT;
+		case 0x22:                      // SHLD
+			EMIT(b, 0xbf);
+			emit32(b, addr);
+			emit_store(b, 3);
+			EMIT(b, 0xbf);
+			emit32(b, (uint16_t)(addr + 1));
+			emit_store(b, 7);
+			return TRANSLATE_NEXT;
+		case 0x2a:                      // LHLD; the second byte would wrap
+			if ( addr == 0xffff )
+			{
+				return TRANSLATE_NO;
+			}
+			EMIT(b, 0x66, 0x8b, 0x9e);
+			emit32(b, addr);
+			return TRANSLATE_NEXT;
+		case 0x07:                      // RLC
+			EMIT(b, 0x9e, 0xd0, 0xc0, 0x9f);
+			return TRANSLATE_NEXT;
+		case 0x0f:                      // RRC
+			EMIT(b, 0x9e, 0xd0, 0xc8, 0x9f);
+			return TRANSLATE_NEXT;
+		case 0x17:                      // RAL
+			EMIT(b, 0x9e, 0xd0, 0xd0, 0x9f);
+			return TRANSLATE_NEXT;
+		case 0x1f:                      // RAR
+			EMIT(b, 0x9e, 0xd0, 0xd8, 0x9f);
+			return TRANSLATE_NEXT;
+		case 0x2f:                      // CMA
+			EMIT(b, 0xf6, 0xd0);
+			return TRANSLATE_NEXT;
+		case 0x37:                      // STC
+			EMIT(b, 0x80, 0xcc, 0x01);
+			return TRANSLATE_NEXT;
+		case 0x3f:                      // CMC
+			EMIT(b, 0x80, 0xf4, 0x01);
+			return TRANSLATE_NEXT;
+		case 0xeb:                      // XCHG
+			EMIT(b, 0x66, 0x87, 0xd3);
+			return TRANSLATE_NEXT;
+		case 0xf9:                      // SPHL
+			EMIT(b, 0x66, 0x89, 0xdd);
+			return TRANSLATE_NEXT;
+		case 0xc5: case 0xd5: case 0xe5: case 0xf5:     // PUSH
+		{
+			int pair = (op >> 4) & 0x3;
+			int high = pair == 3 ? 0 : host8[pair * 2];
+			int low = pair == 3 ? HOST_AH : host8[pair * 2 + 1];
+			emit_push_address(b);
+			emit_store(b, high);
+			emit_push_address(b);
+			emit_store(b, low);
+			return TRANSLATE_NEXT;
+		}
+		case 0xc1: case 0xd1: case 0xe1: case 0xf1:     // POP
+		{
+			int pair = (op >> 4) & 0x3;
+			int high = pair == 3 ? 0 : host8[pair * 2];
+			int low = pair == 3 ? HOST_AH : host8[pair * 2 + 1];
+			emit_address_pair(b, 5);
+			EMIT(b, 0x8a, (low << 3) | 0x04, 0x3e);
+			EMIT(b, 0x66, 0xff, 0xc7);                  // inc di
+			EMIT(b, 0x8a, (high << 3) | 0x04, 0x3e);
+			EMIT(b, 0x66, 0x83, 0xc5, 0x02);            // add bp, 2
+			if ( pair == 3 )
+			{
+				EMIT(b, 0x80, 0xe4, 0xd5);              // and ah, S Z AC P CY
+				EMIT(b, 0x80, 0xcc, 0x02);              // or ah, 2
+			}
+			return TRANSLATE_NEXT;
+		}
+		case 0xe3:                      // XTHL
+			emit_address_pair(b, 5);
+			EMIT(b, 0x44, 0x0f, 0xb6, 0x04, 0x3e);      // movzx r8d, byte [rsi + rdi]
+			emit_store(b, 3);
+			EMIT(b, 0x66, 0xff, 0xc7);                  // inc di
+			EMIT(b, 0x44, 0x0f, 0xb6, 0x0c, 0x3e);      // movzx r9d, byte [rsi + rdi]
+			emit_store(b, 7);
+			EMIT(b, 0x41, 0xc1, 0xe1, 0x08);            // shl r9d, 8
+			EMIT(b, 0x45, 0x09, 0xc8);                  // or r8d, r9d
+			EMIT(b, 0x66, 0x44, 0x89, 0xc3);            // mov bx, r8w
+			return TRANSLATE_NEXT;
+		case 0xfb: case 0xf3:           // EI, DI
+			EMIT(b, 0x41, 0xc6, 0x86);
+			emit32(b, OFFSET(regs.int_enable));
+			EMIT(b, op == 0xfb);
+			return TRANSLATE_NEXT;
+		case 0xdb:                      // IN
+			emit_push_regs(b);
+			EMIT(b, 0xbe);                              // mov esi, port
+			emit32(b, code[1]);
+			EMIT(b, 0x41, 0x8d, 0x97);                  // lea edx, [r15 + cycles]
+			emit32(b, cycles);
+			emit_call(b, jit_in);
+			EMIT(b, 0x88, 0x44, 0x24, 0x48);            // mov [saved rax], al
+			emit_pop_regs(b, 0);
+			return TRANSLATE_NEXT;
+		case 0xd3:                      // OUT
+			emit_push_regs(b);
+			EMIT(b, 0x0f, 0xb6, 0xd0);                  // movzx edx, al
+			EMIT(b, 0xbe);                              // mov esi, port
+			emit32(b, code[1]);
+			emit_call(b, jit_out);
+			emit_pop_regs(b, 0);
+			return TRANSLATE_NEXT;
+		case 0xc3:                      // JMP
+			emit_exit(b, addr, cycles + cost, 1);
+			return TRANSLATE_END;
+		case 0xcd:                      // CALL
+			emit_push_constant(b, next, addr, cycles + cost);
+			emit_exit(b, addr, cycles + cost, 1);
+			return TRANSLATE_END;
+		case 0xc9:                      // RET
+			emit_pop_r8(b);
+			emit_exit_dynamic(b, cycles + cost);
+			return TRANSLATE_END;
+		case 0xe9:                      // PCHL
+			EMIT(b, 0x44, 0x0f, 0xb7, 0xc3);            // movzx r8d, bx
+			emit_exit_dynamic(b, cycles + cost);
+			return TRANSLATE_END;
+		default:                        // DAA, HLT, unused opcodes
+			return TRANSLATE_NO;
+	}
+}
+
+// Translates the block at 'start'; NULL if its first instruction can't be
+static void *translate(struct Jit8080 *jit, uint16_t start)
+{
+	struct JitBlock8080 *b = jit->block;
+	if ( jit->code + JIT_8080_CODE_SIZE - jit->code_next < JIT_8080_BLOCK_BYTES )
+	{
+		jit_8080_flush(jit);
+	}
+	b->jit = jit;
+	b->p = jit->code_next;
+	b->stub_count = 0;
+	uint8_t *entry = b->p;
+	uint16_t pc = start;
+	int cycles = 0;
+	for ( int count = 0; ; count++ )
+	{
+		const uint8_t *code = &jit->memory[pc];
+		int length = instruction_length(code[0]);
+		int blocked = pc + length > MEMORY_SIZE_8080 || count == JIT_8080_BLOCK_INSTRUCTIONS
+			|| cycles + instruction_cycles(code[0]) > JIT_8080_BLOCK_CYCLES;
+		for ( int i = 0; i < length && !blocked; i++ )
+		{
+			blocked = jit->flushes[(pc + i) >> WATCH_8080_PAGE_SHIFT] >= JIT_8080_PAGE_FLUSHES;
+		}
+		uint8_t *before = b->p;
+		int stubs_before = b->stub_count;
+		b->stores = 0;
+		int result = blocked ? TRANSLATE_NO : translate_instruction(b, pc, code, cycles);
+		if ( result == TRANSLATE_NO )
+		{
+			b->p = before;
+			b->stub_count = stubs_before;
+			if ( count == 0 )
+			{
+				return NULL;
+			}
+			emit_exit(b, pc, cycles, 1);
+			break;
+		}
+		for ( int i = 0; i < length; i++ )
+		{
+			jit->watch.pages[(pc + i) >> WATCH_8080_PAGE_SHIFT] = 1;
+			jit->slow[(pc + i) >> WATCH_8080_PAGE_SHIFT] = 1;
+		}
+		if ( result == TRANSLATE_END )
+		{
+			break;
+		}
+		cycles += cycles_8080[code[0]];
+		pc += length;
+		if ( b->stores )
+		{
+			emit_modified_check(b, pc, cycles);
+		}
+	}
+	for ( int i = 0; i < b->stub_count; i++ )
+	{
+		struct Stub *stub = &b->stubs[i];
+		patch(stub->site, b->p);
+		switch (stub->kind)
+		{
+			case STUB_STORE: emit_store_stub(b, stub); break;
+			case STUB_EXIT: emit_exit(b, stub->pc, stub->cycles, 1); break;
+			default: emit_exit(b, stub->pc, stub->cycles, 0); break;
+		}
+	}
+	jit->code_next = b->p;
+	jit->blocks[start] = entry;
+	jit->blocks_translated++;
+	// jumps that were waiting for this block can now go straight to it
+	for ( int i = 0; i < jit->patch_count; )
+	{
+		if ( jit->patches[i].target == start )
+		{
+			patch((uint8_t *)jit->patches[i].site, entry);
+			jit->patches[i] = jit->patches[--jit->patch_count];
+		}
+		else
+		{
+			i++;
+		}
+	}
+	return entry;
+}
+
+// Emits the entry trampoline, int enter(struct Jit8080 *jit, void *block),
+// and the common exit at the start of the code buffer
+static void emit_trampolines(struct Jit8080 *jit)
+{
+	struct JitBlock8080 *b = jit->block;
+	b->jit = jit;
+	b->p = jit->code;
+	jit->enter = (int (*)(struct Jit8080 *, void *))b->p;
+	EMIT(b, 0x53, 0x55, 0x41, 0x56, 0x41, 0x57);   // push rbx, rbp, r14, r15
+	EMIT(b, 0x48, 0x83, 0xec, 0x08);                // align the stack
+	EMIT(b, 0x49, 0x89, 0xfe);                      // mov r14, rdi
+	EMIT(b, 0x49, 0x89, 0xf1);                      // mov r9, rsi
+	EMIT(b, 0x45, 0x31, 0xff);                      // xor r15d, r15d
+	EMIT(b, 0x45, 0x31, 0xdb);                      // xor r11d, r11d
+	// movzx eax/ecx/edx/ebx/ebp, word [r14 + regs...]
+	static const uint8_t load[5] = { 0x86, 0x8e, 0x96, 0x9e, 0xae };
+	for ( int i = 0; i < 5; i++ )
+	{
+		EMIT(b, 0x41, 0x0f, 0xb7, load[i]);
+		emit32(b, OFFSET(regs) + 2 * i);
+	}
+	EMIT(b, 0x49, 0x8b, 0xb6);                      // mov rsi, [r14 + memory]
+	emit32(b, OFFSET(memory));
+	EMIT(b, 0x41, 0xff, 0xe1);                      // jmp r9
+
+	jit->exit = b->p;
+	for ( int i = 0; i < 5; i++ )
+	{
+		EMIT(b, 0x66, 0x41, 0x89, load[i]);         // mov [r14 + regs...], ax/cx/dx/bx/bp
+		emit32(b, OFFSET(regs) + 2 * i);
+	}
+	EMIT(b, 0x44, 0x89, 0xf8);                      // mov eax, r15d
+	EMIT(b, 0x48, 0x83, 0xc4, 0x08);
+	EMIT(b, 0x41, 0x5f, 0x41, 0x5e, 0x5d, 0x5b);   // pop r15, r14, rbp, rbx
+	EMIT(b, 0xc3);
+	jit->code_start = b->p;
+}
+
+struct Jit8080 *jit_8080_create(struct State8080 *state)
+{
+	struct Jit8080 *jit = calloc(1, sizeof(struct Jit8080));
+	if ( jit == NULL )
+	{
+		return NULL;
+	}
+	jit->block = malloc(sizeof(struct JitBlock8080));
+	if ( jit->block == NULL )
+	{
+		free(jit);
+		return NULL;
+	}
+	jit->code = mmap(NULL, JIT_8080_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ( jit->code == MAP_FAILED )
+	{
+		free(jit->block);
+		free(jit);
+		return NULL;
+	}
+	jit->memory = state->memory;
+	jit->state = state;
+	jit->dirty = state->dirty;
+	jit->watch.written = jit_written;
+	jit->watch.ctx = jit;
+	emit_trampolines(jit);
+	jit_8080_flush(jit);
+	jit->flush_count = 0;
+	state->watch = &jit->watch;
+	state->jit = jit;
+	return jit;
+}
+
+void jit_8080_destroy(struct Jit8080 *jit)
+{
+	if ( jit == NULL )
+	{
+		return;
+	}
+	if ( jit->state->jit == jit )
+	{
+		jit->state->jit = NULL;
+		jit->state->watch = NULL;
+	}
+	munmap(jit->code, JIT_8080_CODE_SIZE);
+	free(jit->block);
+	free(jit);
+}
+
+int run_jit_8080(struct State8080 *state, int budget)
+{
+	struct Jit8080 *jit = state->jit;
+	if ( jit == NULL || state->trace != NULL || state->profile != NULL )
+	{
+		return run_for_cycles_8080(state, budget);
+	}
+	if ( jit->dirty != state->dirty )
+	{
+		jit->dirty = state->dirty;
+		set_slow_pages(jit);
+	}
+	int cycles = 0;
+	while ( cycles < budget )
+	{
+		void *block = jit->blocks[state->pc];
+		uint8_t *hits = &jit->hits[state->pc];
+		if ( block == NULL && *hits < JIT_8080_NEVER && ++*hits >= JIT_8080_HOT )
+		{
+			block = translate(jit, state->pc);
+			if ( block == NULL )
+			{
+				*hits = JIT_8080_NEVER;
+			}
+		}
+		// a block only runs if all of it fits, so the interpreter finishes the slice
+		if ( block != NULL && cycles + JIT_8080_BLOCK_CYCLES <= budget )
+		{
+			load_regs(jit, state);
+			jit->chain_limit = budget - cycles - JIT_8080_BLOCK_CYCLES;
+			jit->modified = 0;
+			int ran = jit->enter(jit, block);
+			store_regs(jit, state);
+			state->cycles += ran;
+			jit->native_cycles += ran;
+			cycles += ran;
+		}
+		else
+		{
+			cycles += emulate_8080(state);
+		}
+	}
+	return cycles;
+}
+#else
+struct Jit8080 *jit_8080_create(struct State8080 *state)
+{
+	return NULL;
+}
+
+void jit_8080_destroy(struct Jit8080 *jit)
+{
+}
+
+void jit_8080_flush(struct Jit8080 *jit)
+{
+}
+
+int run_jit_8080(struct State8080 *state, int budget)
+{
+	return run_for_cycles_8080(state, budget);
+}
+#endif
@@ -0,0 +1,99 @@
+#ifndef JIT_8080_H
+#define JIT_8080_H
+
+#include <stdint.h>
+
+#include "emulator_8080.h"
+
+/*
+ * Translation of hot 8080 basic blocks to x86-64 code.
+ *
+ * run_jit_8080 interprets until an address has started JIT_8080_HOT
+ * instructions, then translates the block from there up to the next
+ * JMP/Jcc/CALL/Ccc/RET/Rcc/RST/PCHL (or an instruction it leaves to the
+ * interpreter: DAA, HLT and the unused opcodes) and runs it natively from
+ * then on. Blocks jump straight to the next translated block while the
+ * budget allows. Inside a block the guest registers live in host registers:
+ * A in al, the flags in ah (LAHF puts x86 flags in exactly the PUSH PSW
+ * layout), BC in cx, DE in dx, HL in bx, SP in bp.
+ *
+ * Writes to a page translated code came from (by the guest, through
+ * write_8080, or the interpreter) throw every translation away; a page that
+ * keeps being written is left to the interpreter. Change memory behind the
+ * CPU's back only after jit_8080_flush.
+ *
+ * A block is entered only when it fits in what is left of the budget, so
+ * the instructions run and the cycle counts are exactly the interpreter's.
+ * Port handlers are called from translated code with the registers not yet
+ * written back to the state, so they must only use their context.
+ *
+ * Only x86-64 hosts translate; elsewhere, or when no executable memory can
+ * be had, jit_8080_create returns NULL.
+ */
+#define JIT_8080_HOT 16             // starts before a block is translated
+#define JIT_8080_NEVER 0xff         // hits[] mark for addresses that can't be
+#define JIT_8080_BLOCK_CYCLES 192   // most cycles a block may take
+#define JIT_8080_BLOCK_INSTRUCTIONS 64
+#define JIT_8080_CODE_SIZE (8 << 20)
+#define JIT_8080_PATCHES 4096
+#define JIT_8080_PAGE_FLUSHES 8     // writes that flush a page before it is left to the interpreter
+
+// The guest registers as translated code loads and stores them
+struct JitRegs8080 {
+	uint8_t a;                  // al
+	uint8_t f;                  // ah, PUSH PSW layout
+	uint8_t c;                  // cl
+	uint8_t b;                  // ch
+	uint8_t e;                  // dl
+	uint8_t d;                  // dh
+	uint8_t l;                  // bl
+	uint8_t h;                  // bh
+	uint16_t sp;                // bp
+	uint16_t pc;
+	uint8_t int_enable;
+};
+
+struct JitBlock8080;
+
+// A jump at the end of a block waiting for its target to be translated
+struct JitPatch8080 {
+	uint16_t target;
+	int32_t *site;              // rel32 of the jump
+};
+
+struct Jit8080 {
+	void *blocks[MEMORY_SIZE_8080];     // native entry of the block at each address
+	uint8_t slow[WATCH_8080_PAGES];     // stores to these pages go through write_8080
+	struct JitRegs8080 regs;
+	int32_t chain_limit;        // cycles after which a block must return instead of chaining
+	uint32_t modified;          // set when a write hit translated code
+	uint8_t *memory;
+	struct State8080 *state;
+	uint8_t hits[MEMORY_SIZE_8080];
+	uint8_t flushes[WATCH_8080_PAGES];
+	struct Watch8080 watch;     // pages translated code came from
+	struct Dirty8080 *dirty;    // the range slow[] was last set up for
+	int (*enter)(struct Jit8080 *jit, void *block);
+	uint8_t *code;
+	uint8_t *code_start;        // first byte after the enter/exit stubs
+	uint8_t *code_next;
+	uint8_t *exit;              // common block exit
+	int patch_count;
+	struct JitPatch8080 patches[JIT_8080_PATCHES];
+	struct JitBlock8080 *block; // the block being translated
+	// statistics
+	uint64_t native_cycles;
+	uint64_t blocks_translated;
+	uint64_t flush_count;
+};
+
+// Attaches a JIT to 'state' (state->jit, state->watch); NULL if unavailable
+struct Jit8080 *jit_8080_create(struct State8080 *state);
+void jit_8080_destroy(struct Jit8080 *jit);
+// Discards every translation
+void jit_8080_flush(struct Jit8080 *jit);
+// Same contract as run_for_cycles_8080; interprets when state->jit is NULL
+// or an instruction trace is being kept
+int run_jit_8080(struct State8080 *state, int budget);
+
+#endif
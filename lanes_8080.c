@@ -0,0 +1,827 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "e8080_dissasemble.h"
+#include "emulator_8080.h"
+#include "helpers_8080.h"
+#include "lanes_8080.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LANES_8080_X86
+#define AVX2_8080 __attribute__((target("avx2")))
+#endif
+
+// For every lane in the step's group 'set' (bit i for lane i), lowest first
+#define EACH_LANE(i) \
+	for ( uint32_t rest_ = set; rest_ != 0; rest_ &= rest_ - 1 ) \
+		for ( int i = __builtin_ctz(rest_), once_ = 1; once_; once_ = 0 )
+
+#define PAIR(lanes, hi, lo, i) ((uint16_t)((lanes)->hi[i] << 8 | (lanes)->lo[i]))
+
+// The register an opcode's 3-bit field selects (B C D E H L M A); NULL for M
+static uint8_t *lane_register(struct Lanes8080 *lanes, int field)
+{
+	switch (field)
+	{
+		case 0: return lanes->b;
+		case 1: return lanes->c;
+		case 2: return lanes->d;
+		case 3: return lanes->e;
+		case 4: return lanes->h;
+		case 5: return lanes->l;
+		case 6: return NULL;
+		default: return lanes->a;
+	}
+}
+
+// Jcc/Ccc/Rcc condition 'cond' on flags 'f' in PUSH PSW layout
+static int lane_condition(uint8_t f, int cond)
+{
+	static const uint8_t bits[4] = { 0x40, 0x01, 0x04, 0x80 };   // Z, CY, P, S
+	return ((f & bits[cond >> 1]) != 0) == (cond & 0x1);
+}
+
+static void load_lane(struct Lanes8080 *lanes, int i)
+{
+	struct State8080 *state = lanes->states[i];
+	lanes->a[i] = state->a;
+	lanes->b[i] = state->b;
+	lanes->c[i] = state->c;
+	lanes->d[i] = state->d;
+	lanes->e[i] = state->e;
+	lanes->h[i] = state->h;
+	lanes->l[i] = state->l;
+	lanes->f[i] = psw_8080(state);
+	lanes->int_enable[i] = state->int_enable;
+	lanes->sp[i] = state->sp;
+	lanes->pc[i] = state->pc;
+	lanes->cycles[i] = state->cycles;
+}
+
+// Where lane i's cycle count has got to inside run_lanes_8080
+static uint64_t lane_cycles(struct Lanes8080 *lanes, int i)
+{
+	return lanes->cycles[i] + lanes->budget[i] - lanes->left[i];
+}
+
+static void store_lane(struct Lanes8080 *lanes, int i)
+{
+	struct State8080 *state = lanes->states[i];
+	uint8_t f = lanes->f[i];
+	state->a = lanes->a[i];
+	state->b = lanes->b[i];
+	state->c = lanes->c[i];
+	state->d = lanes->d[i];
+	state->e = lanes->e[i];
+	state->h = lanes->h[i];
+	state->l = lanes->l[i];
+	state->cf.cy = f & 0x1;
+	state->cf.p = (f >> 2) & 0x1;
+	state->cf.ac = (f >> 4) & 0x1;
+	state->cf.z = (f >> 6) & 0x1;
+	state->cf.s = (f >> 7) & 0x1;
+	state->lazy_pending = 0;
+	state->int_enable = lanes->int_enable[i];
+	state->sp = lanes->sp[i];
+	state->pc = lanes->pc[i];
+	state->cycles = lane_cycles(lanes, i);
+}
+
+void lanes_8080_load(struct Lanes8080 *lanes, struct State8080 **states, int count)
+{
+	memset(lanes, 0, sizeof(struct Lanes8080));
+	lanes->count = count;
+	for ( int i = 0; i < count; i++ )
+	{
+		lanes->states[i] = states[i];
+		lanes->memory[i] = states[i]->memory;
+		load_lane(lanes, i);
+	}
+}
+
+void lanes_8080_store(struct Lanes8080 *lanes)
+{
+	for ( int i = 0; i < lanes->count; i++ )
+	{
+		store_lane(lanes, i);
+	}
+}
+
+void interrupt_lanes_8080(struct Lanes8080 *lanes, uint8_t nnn)
+{
+	for ( int i = 0; i < lanes->count; i++ )
+	{
+		if ( lanes->int_enable[i] )
+		{
+			struct State8080 *state = lanes->states[i];
+			lanes->int_enable[i] = 0;
+			store_8080(state, (uint16_t)(lanes->sp[i] - 1), lanes->pc[i] >> 8);
+			store_8080(state, (uint16_t)(lanes->sp[i] - 2), lanes->pc[i] & 0xff);
+			lanes->sp[i] -= 2;
+			lanes->pc[i] = (uint16_t)(nnn << 3);
+			lanes->cycles[i] += cycles_8080[0xc7];
+		}
+	}
+}
+
+// One instruction on one lane through the interpreter; pc and cycles are
+// put back to before the step first
+static void step_fallback(struct Lanes8080 *lanes, int i, uint16_t addr, int cycles)
+{
+	struct State8080 *state = lanes->states[i];
+	struct Trace8080 *trace = state->trace;
+	struct Profile8080 *profile = state->profile;
+	lanes->pc[i] = addr;
+	lanes->left[i] += cycles;
+	store_lane(lanes, i);
+	state->trace = NULL;
+	state->profile = NULL;
+	lanes->left[i] -= emulate_8080(state);
+	state->trace = trace;
+	state->profile = profile;
+	uint64_t total = lanes->cycles[i];
+	load_lane(lanes, i);
+	lanes->cycles[i] = total;
+}
+
+// Memory, stack, I/O and control flow, one lane at a time; returns 0 for
+// opcodes it leaves to others. pc already points past the instruction.
+static int step_lanes(struct Lanes8080 *lanes, uint8_t *code, uint32_t set)
+{
+	uint8_t op = code[0];
+	uint16_t operand = combine_two_8bit(code[1], code[2]);
+	if ( (op & 0xf8) == 0x70 && op != 0x76 )
+	{
+		// MOV M,r
+		uint8_t *reg = lane_register(lanes, op & 0x7);
+		EACH_LANE(i)
+		{
+			store_8080(lanes->states[i], PAIR(lanes, h, l, i), reg[i]);
+		}
+		return 1;
+	}
+	if ( (op & 0xc7) == 0xc2 || op == 0xc3 )
+	{
+		// Jcc, JMP
+		EACH_LANE(i)
+		{
+			if ( op == 0xc3 || lane_condition(lanes->f[i], (op >> 3) & 0x7) )
+			{
+				lanes->pc[i] = operand;
+			}
+		}
+		return 1;
+	}
+	if ( (op & 0xc7) == 0xc4 || op == 0xcd )
+	{
+		// Ccc, CALL
+		EACH_LANE(i)
+		{
+			if ( op == 0xcd || lane_condition(lanes->f[i], (op >> 3) & 0x7) )
+			{
+				store_8080(lanes->states[i], (uint16_t)(lanes->sp[i] - 1), lanes->pc[i] >> 8);
+				store_8080(lanes->states[i], (uint16_t)(lanes->sp[i] - 2), lanes->pc[i] & 0xff);
+				lanes->sp[i] -= 2;
+				lanes->pc[i] = operand;
+				lanes->left[i] -= op == 0xcd ? 0 : 6;
+			}
+		}
+		return 1;
+	}
+	if ( (op & 0xc7) == 0xc0 || op == 0xc9 )
+	{
+		// Rcc, RET
+		EACH_LANE(i)
+		{
+			if ( op == 0xc9 || lane_condition(lanes->f[i], (op >> 3) & 0x7) )
+			{
+				uint8_t *memory = lanes->memory[i];
+				lanes->pc[i] = combine_two_8bit(memory[lanes->sp[i]], memory[(uint16_t)(lanes->sp[i] + 1)]);
+				lanes->sp[i] += 2;
+				lanes->left[i] -= op == 0xc9 ? 0 : 6;
+			}
+		}
+		return 1;
+	}
+	if ( (op & 0xc7) == 0xc7 )
+	{
+		// RST n
+		EACH_LANE(i)
+		{
+			store_8080(lanes->states[i], (uint16_t)(lanes->sp[i] - 1), lanes->pc[i] >> 8);
+			store_8080(lanes->states[i], (uint16_t)(lanes->sp[i] - 2), lanes->pc[i] & 0xff);
+			lanes->sp[i] -= 2;
+			lanes->pc[i] = op & 0x38;
+		}
+		return 1;
+	}
+	if ( (op & 0xcb) == 0xc1 )
+	{
+		// PUSH, POP
+		uint8_t *hi = op & 0x30 ? (op & 0x20 ? (op & 0x10 ? lanes->a : lanes->h) : lanes->d) : lanes->b;
+		uint8_t *lo = op & 0x30 ? (op & 0x20 ? (op & 0x10 ? lanes->f : lanes->l) : lanes->e) : lanes->c;
+		EACH_LANE(i)
+		{
+			uint8_t *memory = lanes->memory[i];
+			if ( op & 0x4 )
+			{
+				store_8080(lanes->states[i], (uint16_t)(lanes->sp[i] - 1), hi[i]);
+				store_8080(lanes->states[i], (uint16_t)(lanes->sp[i] - 2), lo[i]);
+				lanes->sp[i] -= 2;
+			}
+			else
+			{
+				lo[i] = memory[lanes->sp[i]];
+				hi[i] = memory[(uint16_t)(lanes->sp[i] + 1)];
+				lanes->sp[i] += 2;
+			}
+		}
+		if ( op == 0xf1 )
+		{
+			// POP PSW: the bits without a flag read as they always do
+			EACH_LANE(i)
+			{
+				lanes->f[i] = (lanes->f[i] & 0xd5) | 0x02;
+			}
+		}
+		return 1;
+	}
+	switch (op)
+	{
+		case 0x00:  // NOP
+			return 1;
+		case 0x36:  // MVI M
+			EACH_LANE(i)
+			{
+				store_8080(lanes->states[i], PAIR(lanes, h, l, i), code[1]);
+			}
+			return 1;
+		case 0x02:  // STAX B
+		case 0x12:  // STAX D
+			EACH_LANE(i)
+			{
+				store_8080(lanes->states[i], op == 0x02 ? PAIR(lanes, b, c, i) : PAIR(lanes, d, e, i), lanes->a[i]);
+			}
+			return 1;
+		case 0x0a:  // LDAX B
+		case 0x1a:  // LDAX D
+			EACH_LANE(i)
+			{
+				lanes->a[i] = lanes->memory[i][op == 0x0a ? PAIR(lanes, b, c, i) : PAIR(lanes, d, e, i)];
+			}
+			return 1;
+		case 0x32:  // STA
+			EACH_LANE(i)
+			{
+				store_8080(lanes->states[i], operand, lanes->a[i]);
+			}
+			return 1;
+		case 0x3a:  // LDA
+			EACH_LANE(i)
+			{
+				lanes->a[i] = lanes->memory[i][operand];
+			}
+			return 1;
+		case 0x22:  // SHLD
+			EACH_LANE(i)
+			{
+				store_8080(lanes->states[i], operand, lanes->l[i]);
+				store_8080(lanes->states[i], (uint16_t)(operand + 1), lanes->h[i]);
+			}
+			return 1;
+		case 0x2a:  // LHLD
+			EACH_LANE(i)
+			{
+				lanes->l[i] = lanes->memory[i][operand];
+				lanes->h[i] = lanes->memory[i][(uint16_t)(operand + 1)];
+			}
+			return 1;
+		case 0x31:  // LXI SP
+		case 0x33:  // INX SP
+		case 0x3b:  // DCX SP
+		case 0xf9:  // SPHL
+			EACH_LANE(i)
+			{
+				lanes->sp[i] = op == 0x31 ? operand : op == 0x33 ? lanes->sp[i] + 1 : op == 0x3b ? lanes->sp[i] - 1 : PAIR(lanes, h, l, i);
+			}
+			return 1;
+		case 0xe9:  // PCHL
+			EACH_LANE(i)
+			{
+				lanes->pc[i] = PAIR(lanes, h, l, i);
+			}
+			return 1;
+		case 0xfb:  // EI
+		case 0xf3:  // DI
+			EACH_LANE(i)
+			{
+				lanes->int_enable[i] = op == 0xfb;
+			}
+			return 1;
+		case 0xdb:  // IN
+			EACH_LANE(i)
+			{
+				// left[] already has the IN taken off
+				lanes->states[i]->cycles = lane_cycles(lanes, i) - cycles_8080[0xdb];
+				lanes->a[i] = in_8080(lanes->states[i], code[1], 0);
+			}
+			return 1;
+		case 0xd3:  // OUT
+			EACH_LANE(i)
+			{
+				out_8080(lanes->states[i], code[1], lanes->a[i]);
+			}
+			return 1;
+	}
+	return 0;
+}
+
+#ifdef LANES_8080_X86
+
+#define LOAD(p) _mm256_load_si256((const __m256i *)(p))
+#define STORE(p, v) _mm256_store_si256((__m256i *)(p), (v))
+#define BYTES(x) _mm256_set1_epi8((char)(x))
+// new where the lane is in the group, old elsewhere
+#define UPDATE(p, v, m) STORE(p, _mm256_blendv_epi8(LOAD(p), (v), (m)))
+
+// 0xff in the bytes of the lanes in 'set', 0 in the others
+AVX2_8080 static inline __m256i lane_mask_avx2(uint32_t set)
+{
+	// byte i gets byte i / 8 of 'set', then keeps only its own bit
+	const __m256i which = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+	const __m256i bit = _mm256_set1_epi64x(0x8040201008040201);
+	__m256i bytes = _mm256_shuffle_epi8(_mm256_set1_epi32(set), which);
+	return _mm256_cmpeq_epi8(_mm256_and_si256(bytes, bit), bit);
+}
+
+// The same for 16-bit lanes: 'half' 0 is lanes 0-15, 1 is lanes 16-31
+AVX2_8080 static inline __m256i lane_mask16_avx2(uint32_t set, int half)
+{
+	const __m256i bit = _mm256_setr_epi16(0x1, 0x2, 0x4, 0x8, 0x10, 0x20, 0x40, 0x80, 0x100, 0x200, 0x400, 0x800, 0x1000, 0x2000, 0x4000, (short)0x8000);
+	return _mm256_cmpeq_epi16(_mm256_and_si256(_mm256_set1_epi16(set >> (16 * half)), bit), bit);
+}
+
+// And for 32-bit lanes, 'quarter' 0 to 3 being lanes 0-7 to 24-31
+AVX2_8080 static inline __m256i lane_mask32_avx2(uint32_t set, int quarter)
+{
+	const __m256i bit = _mm256_setr_epi32(0x1, 0x2, 0x4, 0x8, 0x10, 0x20, 0x40, 0x80);
+	return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(set >> (8 * quarter)), bit), bit);
+}
+
+// Moves the lanes in 'set' on to 'pc'
+AVX2_8080 static inline void jump_avx2(struct Lanes8080 *lanes, uint32_t set, uint16_t pc)
+{
+	__m256i to = _mm256_set1_epi16(pc);
+	UPDATE(&lanes->pc[0], to, lane_mask16_avx2(set, 0));
+	UPDATE(&lanes->pc[16], to, lane_mask16_avx2(set, 1));
+}
+
+// Steps the group past its instruction
+AVX2_8080 static void advance_avx2(struct Lanes8080 *lanes, uint32_t set, uint16_t pc, int cycles)
+{
+	__m256i taken = _mm256_set1_epi32(cycles);
+	jump_avx2(lanes, set, pc);
+	for ( int quarter = 0; quarter < 4; quarter++ )
+	{
+		__m256i left = LOAD(&lanes->left[8 * quarter]);
+		STORE(&lanes->left[8 * quarter], _mm256_sub_epi32(left, _mm256_and_si256(taken, lane_mask32_avx2(set, quarter))));
+	}
+}
+
+// The lanes with cycles left at the lowest address any of them is at
+AVX2_8080 static uint32_t group_avx2(struct Lanes8080 *lanes, uint16_t *addr)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i ones = _mm256_cmpeq_epi8(zero, zero);
+	// lanes with cycles left, as 16-bit masks in lane order
+	__m256i left_0 = _mm256_cmpgt_epi32(LOAD(&lanes->left[0]), zero);
+	__m256i left_1 = _mm256_cmpgt_epi32(LOAD(&lanes->left[8]), zero);
+	__m256i left_2 = _mm256_cmpgt_epi32(LOAD(&lanes->left[16]), zero);
+	__m256i left_3 = _mm256_cmpgt_epi32(LOAD(&lanes->left[24]), zero);
+	__m256i active_0 = _mm256_permute4x64_epi64(_mm256_packs_epi32(left_0, left_1), 0xd8);
+	__m256i active_1 = _mm256_permute4x64_epi64(_mm256_packs_epi32(left_2, left_3), 0xd8);
+	uint32_t active = _mm256_movemask_epi8(_mm256_permute4x64_epi64(_mm256_packs_epi16(active_0, active_1), 0xd8));
+	if ( active == 0 )
+	{
+		return 0;
+	}
+	// the others count as $ffff, which an active lane may be at too
+	__m256i pc_0 = LOAD(&lanes->pc[0]);
+	__m256i pc_1 = LOAD(&lanes->pc[16]);
+	__m256i lowest = _mm256_min_epu16(_mm256_or_si256(pc_0, _mm256_andnot_si256(active_0, ones)), _mm256_or_si256(pc_1, _mm256_andnot_si256(active_1, ones)));
+	__m128i half = _mm_min_epu16(_mm256_castsi256_si128(lowest), _mm256_extracti128_si256(lowest, 1));
+	*addr = _mm_extract_epi16(_mm_minpos_epu16(half), 0);
+	__m256i at = _mm256_set1_epi16(*addr);
+	__m256i group = _mm256_packs_epi16(_mm256_cmpeq_epi16(pc_0, at), _mm256_cmpeq_epi16(pc_1, at));
+	return active & _mm256_movemask_epi8(_mm256_permute4x64_epi64(group, 0xd8));
+}
+
+// S, Z and P of every lane's result, in their PUSH PSW positions
+AVX2_8080 static inline __m256i zsp_avx2(__m256i r)
+{
+	// 0x04 where a nibble has an odd number of bits set
+	const __m256i odd = _mm256_setr_epi8(0, 4, 4, 0, 4, 0, 0, 4, 4, 0, 0, 4, 0, 4, 4, 0, 0, 4, 4, 0, 4, 0, 0, 4, 4, 0, 0, 4, 0, 4, 4, 0);
+	__m256i low = _mm256_and_si256(r, BYTES(0x0f));
+	__m256i high = _mm256_and_si256(_mm256_srli_epi16(r, 4), BYTES(0x0f));
+	__m256i p = _mm256_xor_si256(_mm256_xor_si256(_mm256_shuffle_epi8(odd, low), _mm256_shuffle_epi8(odd, high)), BYTES(0x04));
+	__m256i z = _mm256_and_si256(_mm256_cmpeq_epi8(r, _mm256_setzero_si256()), BYTES(0x40));
+	return _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(r, BYTES(0x80)), z), p);
+}
+
+// ADD ADC SUB SBB ANA XRA ORA CMP, by 'group', of A and 'b'; as add_8080
+// and friends do, but with the flags worked out at once
+AVX2_8080 static void alu_avx2(struct Lanes8080 *lanes, int group, __m256i b, int immediate, __m256i m)
+{
+	__m256i a = LOAD(lanes->a);
+	__m256i f = LOAD(lanes->f);
+	__m256i zero = _mm256_setzero_si256();
+	__m256i one = BYTES(0x01);
+	__m256i carry_in = _mm256_and_si256(f, one);
+	__m256i r, cy = zero, ac = zero;
+	switch (group)
+	{
+		case 0:     // ADD
+		case 1:     // ADC
+			r = _mm256_add_epi8(a, b);
+			// a sum that wrapped differs from the saturated one
+			cy = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_adds_epu8(a, b), r), one);
+			if ( group == 1 )
+			{
+				cy = _mm256_or_si256(cy, _mm256_and_si256(_mm256_cmpeq_epi8(r, BYTES(0xff)), carry_in));
+				r = _mm256_add_epi8(r, carry_in);
+			}
+			ac = _mm256_and_si256(_mm256_xor_si256(_mm256_xor_si256(a, b), r), BYTES(0x10));
+			break;
+		case 2:     // SUB
+		case 3:     // SBB
+		case 7:     // CMP
+			r = _mm256_sub_epi8(a, b);
+			// a borrow when b > a
+			cy = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_subs_epu8(b, a), zero), one);
+			if ( group == 3 )
+			{
+				cy = _mm256_or_si256(cy, _mm256_and_si256(_mm256_cmpeq_epi8(r, zero), carry_in));
+				r = _mm256_sub_epi8(r, carry_in);
+			}
+			ac = _mm256_and_si256(_mm256_xor_si256(_mm256_xor_si256(a, b), r), BYTES(0x10));
+			break;
+		case 4:     // ANA: AC is not affected; ANI clears it
+			r = _mm256_and_si256(a, b);
+			ac = immediate ? zero : _mm256_and_si256(f, BYTES(0x10));
+			break;
+		case 5:     // XRA
+			r = _mm256_xor_si256(a, b);
+			break;
+		default:    // ORA
+			r = _mm256_or_si256(a, b);
+			break;
+	}
+	if ( group != 7 )
+	{
+		UPDATE(lanes->a, r, m);
+	}
+	UPDATE(lanes->f, _mm256_or_si256(_mm256_or_si256(zsp_avx2(r), ac), _mm256_or_si256(cy, BYTES(0x02))), m);
+}
+
+// The byte at HL of every lane in the group
+static void load_m(struct Lanes8080 *lanes, uint32_t set, uint8_t *out)
+{
+	EACH_LANE(i)
+	{
+		out[i] = lanes->memory[i][PAIR(lanes, h, l, i)];
+	}
+}
+
+// Register and ALU instructions across the group; returns 0 for opcodes it
+// leaves to others. pc already points past the instruction.
+AVX2_8080 static int step_vector(struct Lanes8080 *lanes, uint8_t *code, uint32_t set)
+{
+	uint8_t memory[LANES_8080] __attribute__((aligned(32)));
+	uint8_t op = code[0];
+	__m256i m = lane_mask_avx2(set);
+	__m256i one = BYTES(0x01);
+	if ( (op & 0xc0) == 0x40 && (op & 0x38) != 0x30 )
+	{
+		// MOV r,r and MOV r,M
+		uint8_t *src = lane_register(lanes, op & 0x7);
+		if ( src == NULL )
+		{
+			load_m(lanes, set, memory);
+			src = memory;
+		}
+		UPDATE(lane_register(lanes, (op >> 3) & 0x7), LOAD(src), m);
+		return 1;
+	}
+	if ( (op & 0xc0) == 0x80 || (op & 0xc7) == 0xc6 )
+	{
+		// ALU r, ALU M and the immediate forms
+		__m256i b;
+		if ( op & 0x40 )
+		{
+			b = BYTES(code[1]);
+		}
+		else if ( (op & 0x7) == 0x6 )
+		{
+			load_m(lanes, set, memory);
+			b = LOAD(memory);
+		}
+		else
+		{
+			b = LOAD(lane_register(lanes, op & 0x7));
+		}
+		alu_avx2(lanes, (op >> 3) & 0x7, b, op & 0x40, m);
+		return 1;
+	}
+	if ( (op & 0xc7) == 0x06 && op != 0x36 )
+	{
+		// MVI r
+		UPDATE(lane_register(lanes, (op >> 3) & 0x7), BYTES(code[1]), m);
+		return 1;
+	}
+	if ( (op & 0xc6) == 0x04 && (op & 0x38) != 0x30 )
+	{
+		// INR r, DCR r: CY is kept
+		uint8_t *reg = lane_register(lanes, (op >> 3) & 0x7);
+		__m256i old = LOAD(reg);
+		__m256i r = op & 0x1 ? _mm256_sub_epi8(old, one) : _mm256_add_epi8(old, one);
+		__m256i ac = _mm256_and_si256(_mm256_xor_si256(old, r), BYTES(0x10));
+		__m256i kept = _mm256_and_si256(LOAD(lanes->f), BYTES(0x03));
+		UPDATE(reg, r, m);
+		UPDATE(lanes->f, _mm256_or_si256(_mm256_or_si256(zsp_avx2(r), ac), kept), m);
+		return 1;
+	}
+	if ( (op & 0xc7) == 0x01 || (op & 0xc7) == 0x03 || (op & 0xcf) == 0x09 )
+	{
+		// LXI, INX, DCX and DAD with BC, DE and HL
+		int pair = (op >> 4) & 0x3;
+		if ( pair == 3 )
+		{
+			return 0;
+		}
+		uint8_t *hi = pair == 0 ? lanes->b : pair == 1 ? lanes->d : lanes->h;
+		uint8_t *lo = pair == 0 ? lanes->c : pair == 1 ? lanes->e : lanes->l;
+		__m256i h = LOAD(hi);
+		__m256i l = LOAD(lo);
+		if ( (op & 0xf) == 0x1 )
+		{
+			UPDATE(lo, BYTES(code[1]), m);
+			UPDATE(hi, BYTES(code[2]), m);
+		}
+		else if ( (op & 0xf) == 0x3 )
+		{
+			// INX: the high byte goes up (subtracting the all-ones compare) where the low one wrapped
+			l = _mm256_add_epi8(l, one);
+			UPDATE(lo, l, m);
+			UPDATE(hi, _mm256_sub_epi8(h, _mm256_cmpeq_epi8(l, _mm256_setzero_si256())), m);
+		}
+		else if ( (op & 0xf) == 0xb )
+		{
+			// DCX
+			UPDATE(hi, _mm256_add_epi8(h, _mm256_cmpeq_epi8(l, _mm256_setzero_si256())), m);
+			UPDATE(lo, _mm256_sub_epi8(l, one), m);
+		}
+		else
+		{
+			// DAD: HL += pair, CY is the carry out of bit 15
+			__m256i hl_h = LOAD(lanes->h);
+			__m256i hl_l = LOAD(lanes->l);
+			__m256i sum_l = _mm256_add_epi8(hl_l, l);
+			__m256i carry_l = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_adds_epu8(hl_l, l), sum_l), one);
+			__m256i sum_h = _mm256_add_epi8(hl_h, h);
+			__m256i cy = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_adds_epu8(hl_h, h), sum_h), one);
+			cy = _mm256_or_si256(cy, _mm256_and_si256(_mm256_cmpeq_epi8(sum_h, BYTES(0xff)), carry_l));
+			UPDATE(lanes->l, sum_l, m);
+			UPDATE(lanes->h, _mm256_add_epi8(sum_h, carry_l), m);
+			UPDATE(lanes->f, _mm256_or_si256(_mm256_andnot_si256(one, LOAD(lanes->f)), cy), m);
+		}
+		return 1;
+	}
+	if ( (op & 0xc7) == 0xc2 || op == 0xc3 )
+	{
+		// Jcc, JMP: the lanes whose flag bit is as the condition wants
+		static const uint8_t bits[4] = { 0x40, 0x01, 0x04, 0x80 };   // Z, CY, P, S
+		if ( op != 0xc3 )
+		{
+			__m256i clear = _mm256_cmpeq_epi8(_mm256_and_si256(LOAD(lanes->f), BYTES(bits[(op >> 4) & 0x3])), _mm256_setzero_si256());
+			uint32_t flag_set = ~_mm256_movemask_epi8(clear);
+			set &= op & 0x8 ? flag_set : ~flag_set;
+		}
+		jump_avx2(lanes, set, combine_two_8bit(code[1], code[2]));
+		return 1;
+	}
+	switch (op)
+	{
+		case 0xeb:  // XCHG
+		{
+			__m256i d = LOAD(lanes->d);
+			__m256i e = LOAD(lanes->e);
+			UPDATE(lanes->d, LOAD(lanes->h), m);
+			UPDATE(lanes->e, LOAD(lanes->l), m);
+			UPDATE(lanes->h, d, m);
+			UPDATE(lanes->l, e, m);
+			return 1;
+		}
+		case 0x2f:  // CMA
+			UPDATE(lanes->a, _mm256_xor_si256(LOAD(lanes->a), BYTES(0xff)), m);
+			return 1;
+		case 0x37:  // STC
+			UPDATE(lanes->f, _mm256_or_si256(LOAD(lanes->f), one), m);
+			return 1;
+		case 0x3f:  // CMC
+			UPDATE(lanes->f, _mm256_xor_si256(LOAD(lanes->f), one), m);
+			return 1;
+		case 0x07:  // RLC
+		case 0x0f:  // RRC
+		case 0x17:  // RAL
+		case 0x1f:  // RAR
+		{
+			__m256i a = LOAD(lanes->a);
+			__m256i f = LOAD(lanes->f);
+			// what comes in at the other end: the bit going out, or CY through carry
+			__m256i top = _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_setzero_si256(), a), one);
+			__m256i bottom = _mm256_and_si256(a, one);
+			__m256i in = op == 0x07 ? top : op == 0x0f ? bottom : _mm256_and_si256(f, one);
+			__m256i r;
+			if ( op & 0x8 )
+			{
+				r = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(a, 1), BYTES(0x7f)), _mm256_slli_epi16(in, 7));
+			}
+			else
+			{
+				r = _mm256_or_si256(_mm256_add_epi8(a, a), in);
+			}
+			UPDATE(lanes->a, r, m);
+			UPDATE(lanes->f, _mm256_or_si256(_mm256_andnot_si256(one, f), op & 0x8 ? bottom : top), m);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int lanes_8080_vector(void)
+{
+	return __builtin_cpu_supports("avx2") != 0;
+}
+
+#else
+
+static void advance_avx2(struct Lanes8080 *lanes, uint32_t set, uint16_t pc, int cycles)
+{
+}
+
+static uint32_t group_avx2(struct Lanes8080 *lanes, uint16_t *addr)
+{
+	return 0;
+}
+
+static int step_vector(struct Lanes8080 *lanes, uint8_t *code, uint32_t set)
+{
+	return 0;
+}
+
+int lanes_8080_vector(void)
+{
+	return 0;
+}
+
+#endif
+
+// The lanes with cycles left at the lowest address any of them is at
+static uint32_t group_scalar(struct Lanes8080 *lanes, uint16_t *addr)
+{
+	int leader = -1;
+	for ( int i = 0; i < lanes->count; i++ )
+	{
+		if ( lanes->left[i] > 0 && (leader < 0 || lanes->pc[i] < lanes->pc[leader]) )
+		{
+			leader = i;
+		}
+	}
+	if ( leader < 0 )
+	{
+		return 0;
+	}
+	uint32_t set = 0;
+	for ( int i = leader; i < lanes->count; i++ )
+	{
+		if ( lanes->left[i] > 0 && lanes->pc[i] == lanes->pc[leader] )
+		{
+			set |= (uint32_t)1 << i;
+		}
+	}
+	*addr = lanes->pc[leader];
+	return set;
+}
+
+void run_lanes_8080(struct Lanes8080 *lanes, uint64_t until)
+{
+	int vector = lanes_8080_vector();
+	for ( int i = 0; i < LANES_8080; i++ )
+	{
+		lanes->budget[i] = i < lanes->count && lanes->cycles[i] < until ? until - lanes->cycles[i] : 0;
+		lanes->left[i] = lanes->budget[i];
+	}
+	for ( ;; )
+	{
+		uint16_t addr;
+		uint32_t set = vector ? group_avx2(lanes, &addr) : group_scalar(lanes, &addr);
+		if ( set == 0 )
+		{
+			break;
+		}
+
+		// the lanes at 'addr' whose memory holds the same instruction there as
+		// the first one's; a copy, as for the interpreter, because a store may
+		// overwrite the operands
+		static const uint8_t sizes[4][4] = { { 0 }, { 0xff }, { 0xff, 0xff }, { 0xff, 0xff, 0xff } };
+		uint8_t code[4];
+		uint32_t word, bytes, other;
+		memcpy(code, &lanes->memory[__builtin_ctz(set)][addr], 4);
+		int size = e8080_instruction_size(code[0]);
+		int cycles = cycles_8080[code[0]];
+		memcpy(&word, code, 4);
+		memcpy(&bytes, sizes[size], 4);
+		for ( uint32_t rest = set; rest != 0; rest &= rest - 1 )
+		{
+			int i = __builtin_ctz(rest);
+			memcpy(&other, &lanes->memory[i][addr], 4);
+			if ( ((other ^ word) & bytes) != 0 )
+			{
+				set &= ~((uint32_t)1 << i);
+			}
+		}
+		if ( vector )
+		{
+			advance_avx2(lanes, set, addr + size, cycles);
+		}
+		else
+		{
+			EACH_LANE(i)
+			{
+				lanes->pc[i] = addr + size;
+				lanes->left[i] -= cycles;
+			}
+		}
+		lanes->steps++;
+		lanes->lane_steps += __builtin_popcount(set);
+
+		if ( !(vector && step_vector(lanes, code, set)) && !step_lanes(lanes, code, set) )
+		{
+			EACH_LANE(i)
+			{
+				step_fallback(lanes, i, addr, cycles);
+			}
+		}
+	}
+	for ( int i = 0; i < lanes->count; i++ )
+	{
+		lanes->cycles[i] = lane_cycles(lanes, i);
+		lanes->budget[i] = lanes->left[i];
+	}
+}
+
+void run_scheduled_lanes_8080(struct Lanes8080 *lanes, struct Scheduler8080 **schedulers, uint64_t until)
+{
+	for ( ;; )
+	{
+		// the lanes still short of 'until' run up to the first event due on any of them
+		uint32_t behind = 0;
+		uint64_t next = until;
+		for ( int i = 0; i < lanes->count; i++ )
+		{
+			if ( lanes->cycles[i] < until )
+			{
+				behind |= 1u << i;
+				if ( schedulers[i]->count > 0 && schedulers[i]->events[0].when < next )
+				{
+					next = schedulers[i]->events[0].when;
+				}
+			}
+		}
+		if ( behind == 0 )
+		{
+			break;
+		}
+		run_lanes_8080(lanes, next);
+		// events fire on the lane's own state, as run_scheduled_8080 fires them
+		for ( uint32_t rest = behind; rest != 0; rest &= rest - 1 )
+		{
+			int i = __builtin_ctz(rest);
+			struct Scheduler8080 *scheduler = schedulers[i];
+			if ( scheduler->count == 0 || scheduler->events[0].when > lanes->cycles[i] )
+			{
+				continue;
+			}
+			store_lane(lanes, i);
+			while ( scheduler->count > 0 && scheduler->events[0].when <= lanes->states[i]->cycles )
+			{
+				struct Event8080 event = scheduler->events[0];
+				scheduler->count--;
+				memmove(&scheduler->events[0], &scheduler->events[1], scheduler->count * sizeof(struct Event8080));
+				event.fire(lanes->states[i], event.ctx);
+			}
+			load_lane(lanes, i);
+		}
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef LANES_8080_H
+#define LANES_8080_H
+
+#include <stdint.h>
+
+#include "emulator_8080.h"
+
+/*
+ * Lockstep execution of many CPUs running the same code, e.g. one ROM with
+ * different inputs. The registers of LANES_8080 CPUs are kept as arrays
+ * with one entry per lane (so one AVX2 register holds an 8080 register of
+ * every lane), and each step runs one instruction on all the lanes that are
+ * at the same address and hold the same instruction bytes there. Lanes that
+ * went another way wait: the group at the lowest address runs first, which
+ * brings lanes back together after a branch skips code or leaves a loop.
+ *
+ * Register, ALU and 16-bit pair instructions run as AVX2 vector code over
+ * all the lanes of a group; memory, stack, I/O and branches loop over the
+ * lanes; anything else (and everything on hosts without AVX2) runs lane by
+ * lane through emulate_8080. Memory, ports and write tracking are those of
+ * each lane's State8080, and every lane runs exactly the instructions, and
+ * takes exactly the cycles, it would running alone. Lanes are not traced or
+ * profiled.
+ */
+#define LANES_8080 32
+
+struct Lanes8080 {
+	// 8-bit registers, one byte per lane
+	uint8_t a[LANES_8080] __attribute__((aligned(32)));
+	uint8_t b[LANES_8080] __attribute__((aligned(32)));
+	uint8_t c[LANES_8080] __attribute__((aligned(32)));
+	uint8_t d[LANES_8080] __attribute__((aligned(32)));
+	uint8_t e[LANES_8080] __attribute__((aligned(32)));
+	uint8_t h[LANES_8080] __attribute__((aligned(32)));
+	uint8_t l[LANES_8080] __attribute__((aligned(32)));
+	uint8_t f[LANES_8080] __attribute__((aligned(32)));     // flags as PUSH PSW stores them
+	uint8_t int_enable[LANES_8080];
+	uint16_t sp[LANES_8080];
+	uint16_t pc[LANES_8080] __attribute__((aligned(32)));
+	uint64_t cycles[LANES_8080];
+	int32_t left[LANES_8080] __attribute__((aligned(32)));   // cycles still to run in run_lanes_8080
+	int32_t budget[LANES_8080];             // left[] when run_lanes_8080 started
+	struct State8080 *states[LANES_8080];   // memory and devices of each lane
+	uint8_t *memory[LANES_8080];            // states[i]->memory
+	int count;                  // lanes in use
+	uint64_t steps;             // instructions issued
+	uint64_t lane_steps;        // instructions run, over all lanes
+};
+
+// Takes the registers of count (<= LANES_8080) CPUs; they must be stored
+// back with lanes_8080_store before anything else uses those states
+void lanes_8080_load(struct Lanes8080 *lanes, struct State8080 **states, int count);
+void lanes_8080_store(struct Lanes8080 *lanes);
+// Runs every lane until its cycle count has reached 'until', as
+// run_for_cycles_8080 would with a budget of until - cycles (which must fit
+// in an int)
+void run_lanes_8080(struct Lanes8080 *lanes, uint64_t until);
+// run_scheduled_8080 on every lane, up to the same cycle: the lanes run in
+// lockstep to the next event due on any of them, which fires on that lane's
+// state. schedulers[i] belongs to lane i; returns when every lane has
+// reached 'until'
+void run_scheduled_lanes_8080(struct Lanes8080 *lanes, struct Scheduler8080 **schedulers, uint64_t until);
+// interrupt_8080 on every lane
+void interrupt_lanes_8080(struct Lanes8080 *lanes, uint8_t nnn);
+// Nonzero when the vector code can run on this host
+int lanes_8080_vector(void);
+
+#endif
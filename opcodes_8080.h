@@ -0,0 +1,629 @@
+/*
+ * Instruction bodies shared by every interpreter loop. This file has no include
+ * guard on purpose: the includer defines OPCODE(op, ...) to turn each body into
+ * a switch case, a threaded-dispatch handler, etc., includes it and undefines
+ * OPCODE again.
+ *
+ * A body runs with
+ *   'state'     the struct State8080 being executed
+ *   'state_mem' state->memory
+ *   'opcode'    a pointer to the opcode byte; operands are opcode[1] and opcode[2].
+ *               It may point at a copy (run_predecoded_8080), so read the
+ *               operands before a store that could overwrite them
+ *   'cycles'    an int the body adds to when the instruction takes longer
+ *               than its cycles_8080 entry (taken conditional CALL/RET)
+ *   ELAPSED_8080  the cycles the loop has run before this instruction and
+ *               not yet added to state->cycles, so IN can stamp its read
+ *               with the exact cycle count
+ * and 'state->pc' already pointing past the opcode byte. Bodies read
+ * state_mem directly but write memory only through store_8080 (or call
+ * touch_8080 after changing a byte in place) so write tracking sees it.
+ */
+
+// MOV r1,r2
+OPCODE(0x40, )
+OPCODE(0x41, state->b = state->c;)
+OPCODE(0x42, state->b = state->d;)
+OPCODE(0x43, state->b = state->e;)
+OPCODE(0x44, state->b = state->h;)
+OPCODE(0x45, state->b = state->l;)
+OPCODE(0x47, state->b = state->a;)
+OPCODE(0x48, state->c = state->b;)
+OPCODE(0x49, )
+OPCODE(0x4a, state->c = state->d;)
+OPCODE(0x4b, state->c = state->e;)
+OPCODE(0x4c, state->c = state->h;)
+OPCODE(0x4d, state->c = state->l;)
+OPCODE(0x4f, state->c = state->a;)
+OPCODE(0x50, state->d = state->b;)
+OPCODE(0x51, state->d = state->c;)
+OPCODE(0x52, )
+OPCODE(0x53, state->d = state->e;)
+OPCODE(0x54, state->d = state->h;)
+OPCODE(0x55, state->d = state->l;)
+OPCODE(0x57, state->d = state->a;)
+OPCODE(0x58, state->e = state->b;)
+OPCODE(0x59, state->e = state->c;)
+OPCODE(0x5a, state->e = state->d;)
+OPCODE(0x5b, )
+OPCODE(0x5c, state->e = state->h;)
+OPCODE(0x5d, state->e = state->l;)
+OPCODE(0x5f, state->e = state->a;)
+OPCODE(0x60, state->h = state->b;)
+OPCODE(0x61, state->h = state->c;)
+OPCODE(0x62, state->h = state->d;)
+OPCODE(0x63, state->h = state->e;)
+OPCODE(0x64, )
+OPCODE(0x65, state->h = state->l;)
+OPCODE(0x67, state->h = state->a;)
+OPCODE(0x68, state->l = state->b;)
+OPCODE(0x69, state->l = state->c;)
+OPCODE(0x6a, state->l = state->d;)
+OPCODE(0x6b, state->l = state->e;)
+OPCODE(0x6c, state->l = state->h;)
+OPCODE(0x6d, )
+OPCODE(0x6f, state->l = state->a;)
+OPCODE(0x78, state->a = state->b;)
+OPCODE(0x79, state->a = state->c;)
+OPCODE(0x7a, state->a = state->d;)
+OPCODE(0x7b, state->a = state->e;)
+OPCODE(0x7c, state->a = state->h;)
+OPCODE(0x7d, state->a = state->l;)
+OPCODE(0x7f, )
+
+// MOV r,M
+OPCODE(0x46, state->b = state_mem[combine_two_8bit(state->l, state->h)];)
+OPCODE(0x4e, state->c = state_mem[combine_two_8bit(state->l, state->h)];)
+OPCODE(0x56, state->d = state_mem[combine_two_8bit(state->l, state->h)];)
+OPCODE(0x5e, state->e = state_mem[combine_two_8bit(state->l, state->h)];)
+OPCODE(0x66, state->h = state_mem[combine_two_8bit(state->l, state->h)];)
+OPCODE(0x6e, state->l = state_mem[combine_two_8bit(state->l, state->h)];)
+OPCODE(0x7e, state->a = state_mem[combine_two_8bit(state->l, state->h)];)
+
+// MOV M,r
+OPCODE(0x70, store_8080(state, combine_two_8bit(state->l, state->h), state->b);)
+OPCODE(0x71, store_8080(state, combine_two_8bit(state->l, state->h), state->c);)
+OPCODE(0x72, store_8080(state, combine_two_8bit(state->l, state->h), state->d);)
+OPCODE(0x73, store_8080(state, combine_two_8bit(state->l, state->h), state->e);)
+OPCODE(0x74, store_8080(state, combine_two_8bit(state->l, state->h), state->h);)
+OPCODE(0x75, store_8080(state, combine_two_8bit(state->l, state->h), state->l);)
+OPCODE(0x77, store_8080(state, combine_two_8bit(state->l, state->h), state->a);)
+
+// MVI r,data
+OPCODE(0x06,
+	state->b = opcode[1];
+	state->pc++;
+)
+OPCODE(0x0e,
+	state->c = opcode[1];
+	state->pc++;
+)
+OPCODE(0x16,
+	state->d = opcode[1];
+	state->pc++;
+)
+OPCODE(0x1e,
+	state->e = opcode[1];
+	state->pc++;
+)
+OPCODE(0x26,
+	state->h = opcode[1];
+	state->pc++;
+)
+OPCODE(0x2e,
+	state->l = opcode[1];
+	state->pc++;
+)
+OPCODE(0x3e,
+	state->a = opcode[1];
+	state->pc++;
+)
+
+// MVI M,data
+OPCODE(0x36,
+	store_8080(state, combine_two_8bit(state->l, state->h), opcode[1]);
+	state->pc++;
+)
+
+// LXI rp,data16
+OPCODE(0x01,
+	state->b = opcode[2];
+	state->c = opcode[1];
+	state->pc+=2;			// advance PC to the end of instruction
+)
+OPCODE(0x11,
+	state->d = opcode[2];
+	state->e = opcode[1];
+	state->pc+=2;
+)
+OPCODE(0x21,
+	state->h = opcode[2];
+	state->l = opcode[1];
+	state->pc+=2;
+)
+OPCODE(0x31,
+	state->sp = combine_two_8bit(opcode[1], opcode[2]);
+	state->pc+=2;
+)
+
+// LDA addr
+OPCODE(0x3a,
+	state->a = state_mem[combine_two_8bit(opcode[1], opcode[2])];
+	state->pc += 2;
+)
+
+// STA addr
+OPCODE(0x32,
+	store_8080(state, combine_two_8bit(opcode[1], opcode[2]), state->a);
+	state->pc += 2;
+)
+
+// LHLD addr
+OPCODE(0x2a,
+	state->l = state_mem[combine_two_8bit(opcode[1], opcode[2])];
+	state->h = state_mem[(uint16_t)(combine_two_8bit(opcode[1], opcode[2]) + 1)];
+	state->pc += 2;
+)
+
+// SHLD addr
+OPCODE(0x22,
+	{
+		// the address is taken once: the first store may overwrite the operand
+		uint16_t addr = combine_two_8bit(opcode[1], opcode[2]);
+		store_8080(state, addr, state->l);
+		store_8080(state, (uint16_t)(addr + 1), state->h);
+		state->pc += 2;
+	}
+)
+
+// LDAX rp
+OPCODE(0x0a, state->a = state_mem[combine_two_8bit(state->c, state->b)];)
+OPCODE(0x1a, state->a = state_mem[combine_two_8bit(state->e, state->d)];)
+
+// STAX rp
+OPCODE(0x02, store_8080(state, combine_two_8bit(state->c, state->b), state->a);)
+OPCODE(0x12, store_8080(state, combine_two_8bit(state->e, state->d), state->a);)
+
+// XCHG
+OPCODE(0xeb,
+	{
+		uint8_t tmp1, tmp2;
+		tmp1 = state->h;
+		tmp2 = state->l;
+		state->h = state->d;
+		state->l = state->e;
+		state->d = tmp1;
+		state->e = tmp2;
+	}
+)
+
+// ADD r
+OPCODE(0x80, add_8080(state, state->b, 0);)
+OPCODE(0x81, add_8080(state, state->c, 0);)
+OPCODE(0x82, add_8080(state, state->d, 0);)
+OPCODE(0x83, add_8080(state, state->e, 0);)
+OPCODE(0x84, add_8080(state, state->h, 0);)
+OPCODE(0x85, add_8080(state, state->l, 0);)
+OPCODE(0x87, add_8080(state, state->a, 0);)
+
+// ADD M
+OPCODE(0x86, add_8080(state, state_mem[combine_two_8bit(state->l, state->h)], 0);)
+
+// ADI data
+OPCODE(0xc6,
+	add_8080(state, opcode[1], 0);
+	state->pc++;
+)
+
+// ADC r
+OPCODE(0x88, add_8080(state, state->b, 1);)
+OPCODE(0x89, add_8080(state, state->c, 1);)
+OPCODE(0x8a, add_8080(state, state->d, 1);)
+OPCODE(0x8b, add_8080(state, state->e, 1);)
+OPCODE(0x8c, add_8080(state, state->h, 1);)
+OPCODE(0x8d, add_8080(state, state->l, 1);)
+OPCODE(0x8f, add_8080(state, state->a, 1);)
+
+// ADC M
+OPCODE(0x8e, add_8080(state, state_mem[combine_two_8bit(state->l, state->h)], 1);)
+
+// ACI data
+OPCODE(0xce,
+	add_8080(state, opcode[1], 1);
+	state->pc++;
+)
+
+// SUB r
+OPCODE(0x90, sub_8080(state, state->b, 0);)
+OPCODE(0x91, sub_8080(state, state->c, 0);)
+OPCODE(0x92, sub_8080(state, state->d, 0);)
+OPCODE(0x93, sub_8080(state, state->e, 0);)
+OPCODE(0x94, sub_8080(state, state->h, 0);)
+OPCODE(0x95, sub_8080(state, state->l, 0);)
+OPCODE(0x97, sub_8080(state, state->a, 0);)
+
+// SUB M
+OPCODE(0x96, sub_8080(state, state_mem[combine_two_8bit(state->l, state->h)], 0);)
+
+// SUI data
+OPCODE(0xd6,
+	sub_8080(state, opcode[1], 0);
+	state->pc++;
+)
+
+// SBB r
+OPCODE(0x98, sub_8080(state, state->b, 1);)
+OPCODE(0x99, sub_8080(state, state->c, 1);)
+OPCODE(0x9a, sub_8080(state, state->d, 1);)
+OPCODE(0x9b, sub_8080(state, state->e, 1);)
+OPCODE(0x9c, sub_8080(state, state->h, 1);)
+OPCODE(0x9d, sub_8080(state, state->l, 1);)
+OPCODE(0x9f, sub_8080(state, state->a, 1);)
+
+// SBB M
+OPCODE(0x9e, sub_8080(state, state_mem[combine_two_8bit(state->l, state->h)], 1);)
+
+// SBI data
+OPCODE(0xde,
+	sub_8080(state, opcode[1], 1);
+	state->pc++;
+)
+
+// INR r
+OPCODE(0x04, inr_8080(state, &state->b);)
+OPCODE(0x0c, inr_8080(state, &state->c);)
+OPCODE(0x14, inr_8080(state, &state->d);)
+OPCODE(0x1c, inr_8080(state, &state->e);)
+OPCODE(0x24, inr_8080(state, &state->h);)
+OPCODE(0x2c, inr_8080(state, &state->l);)
+OPCODE(0x3c, inr_8080(state, &state->a);)
+
+// INR M
+OPCODE(0x34,
+	{
+		uint16_t addr = combine_two_8bit(state->l, state->h);
+		inr_8080(state, &state_mem[addr]);
+		touch_8080(state, addr);
+	}
+)
+
+// DCR r
+OPCODE(0x05, dcr_8080(state, &state->b);)
+OPCODE(0x0d, dcr_8080(state, &state->c);)
+OPCODE(0x15, dcr_8080(state, &state->d);)
+OPCODE(0x1d, dcr_8080(state, &state->e);)
+OPCODE(0x25, dcr_8080(state, &state->h);)
+OPCODE(0x2d, dcr_8080(state, &state->l);)
+OPCODE(0x3d, dcr_8080(state, &state->a);)
+
+// DCR M
+OPCODE(0x35,
+	{
+		uint16_t addr = combine_two_8bit(state->l, state->h);
+		dcr_8080(state, &state_mem[addr]);
+		touch_8080(state, addr);
+	}
+)
+
+// INX r
+OPCODE(0x03, inx_8080(state, 0);)
+OPCODE(0x13, inx_8080(state, 1);)
+OPCODE(0x23, inx_8080(state, 2);)
+OPCODE(0x33, inx_8080(state, 3);)
+
+// DCX r
+OPCODE(0x0b, dcx_8080(state, 0);)
+OPCODE(0x1b, dcx_8080(state, 1);)
+OPCODE(0x2b, dcx_8080(state, 2);)
+OPCODE(0x3b, dcx_8080(state, 3);)
+
+// DAD rp
+OPCODE(0x09, dad_8080(state, 0);)
+OPCODE(0x19, dad_8080(state, 1);)
+OPCODE(0x29, dad_8080(state, 2);)
+OPCODE(0x39, dad_8080(state, 3);)
+
+// DAA
+OPCODE(0x27,
+	materialize_flags(state);
+	if ( ((state->a & 0xf) > 9) || state->cf.ac)
+	{
+		state->cf.ac = 1;
+		state->a += 6;
+	}
+	else
+	{
+		state->cf.ac = 0;
+	}
+	
+	if ( ((state->a  & 0xf0) > 0x90) || state->cf.cy)
+	{
+		state->cf.cy = 1;
+		state->a = ((state->a & 0xf0) + 0x60) | (state->a & 0xf);
+	}
+	set_zsp(state, state->a);
+)
+
+// ANA r
+OPCODE(0xa0, and_8080(state, state->b);)
+OPCODE(0xa1, and_8080(state, state->c);)
+OPCODE(0xa2, and_8080(state, state->d);)
+OPCODE(0xa3, and_8080(state, state->e);)
+OPCODE(0xa4, and_8080(state, state->h);)
+OPCODE(0xa5, and_8080(state, state->l);)
+OPCODE(0xa7, and_8080(state, state->a);)
+
+// ANA M
+OPCODE(0xa6, and_8080(state, state_mem[combine_two_8bit(state->l, state->h)]);)
+
+// ANI data
+OPCODE(0xe6,
+	and_8080(state, opcode[1]);
+	state->lazy_aux = 0; // ANI also clears AC
+	state->lazy_pending |= LAZY_AC;
+	state->pc++;
+)
+
+// XRA r
+OPCODE(0xa8, xor_8080(state, state->b);)
+OPCODE(0xa9, xor_8080(state, state->c);)
+OPCODE(0xaa, xor_8080(state, state->d);)
+OPCODE(0xab, xor_8080(state, state->e);)
+OPCODE(0xac, xor_8080(state, state->h);)
+OPCODE(0xad, xor_8080(state, state->l);)
+OPCODE(0xaf, xor_8080(state, state->a);)
+
+// XRA M
+OPCODE(0xae, xor_8080(state, state_mem[combine_two_8bit(state->l, state->h)]);)
+
+// XRI data
+OPCODE(0xee,
+	xor_8080(state, opcode[1]);
+	state->pc++;
+)
+
+// ORA r
+OPCODE(0xb0, or_8080(state, state->b);)
+OPCODE(0xb1, or_8080(state, state->c);)
+OPCODE(0xb2, or_8080(state, state->d);)
+OPCODE(0xb3, or_8080(state, state->e);)
+OPCODE(0xb4, or_8080(state, state->h);)
+OPCODE(0xb5, or_8080(state, state->l);)
+OPCODE(0xb7, or_8080(state, state->a);)
+
+// ORA M
+OPCODE(0xb6, or_8080(state, state_mem[combine_two_8bit(state->l, state->h)]);)
+
+// ORI data
+OPCODE(0xf6,
+	or_8080(state, opcode[1]);
+	state->pc++;
+)
+
+// CMP r
+OPCODE(0xb8, cmp_8080(state, state->b);)
+OPCODE(0xb9, cmp_8080(state, state->c);)
+OPCODE(0xba, cmp_8080(state, state->d);)
+OPCODE(0xbb, cmp_8080(state, state->e);)
+OPCODE(0xbc, cmp_8080(state, state->h);)
+OPCODE(0xbd, cmp_8080(state, state->l);)
+OPCODE(0xbf, cmp_8080(state, state->a);)
+
+// CMP M
+OPCODE(0xbe, cmp_8080(state, state_mem[combine_two_8bit(state->l, state->h)]);)
+
+// CPI data
+OPCODE(0xfe,
+	cmp_8080(state, opcode[1]);
+	state->pc++;
+)
+
+// RLC
+OPCODE(0x07,
+	state->lazy_pending &= ~LAZY_CY;
+	state->cf.cy = state->a >> 7;
+	state->a = (state->a << 1) | state->cf.cy;
+)
+
+// RRC
+OPCODE(0x0f,
+	state->lazy_pending &= ~LAZY_CY;
+	state->cf.cy = state->a & 0x01;
+	state->a = (state->cf.cy << 7) | (state->a >> 1);
+)
+
+// RAL
+OPCODE(0x17,
+	materialize_carry(state);
+	{
+		uint8_t tmp = state->a >> 7;
+		state->a = (state->a << 1) | state->cf.cy;
+		state->cf.cy = tmp;
+	}
+)
+
+// RAR
+OPCODE(0x1f,
+	materialize_carry(state);
+	{
+		uint8_t tmp = state->a & 0x01;
+		state->a = (state->cf.cy << 7) | (state->a >> 1);
+		state->cf.cy = tmp;
+	}
+)
+
+// CMA
+OPCODE(0x2f, state->a = ~state->a;)
+
+// CMC
+OPCODE(0x3f,
+	materialize_carry(state);
+	state->cf.cy = ~state->cf.cy;
+)
+
+// STC
+OPCODE(0x37,
+	state->lazy_pending &= ~LAZY_CY;
+	state->cf.cy = 1;
+)
+
+// JMP addr
+OPCODE(0xc3, state->pc = combine_two_8bit(opcode[1], opcode[2]);)
+
+// Jcondition addr
+OPCODE(0xc2, jmp_8080(state, opcode[1], opcode[2], 0);)
+OPCODE(0xca, jmp_8080(state, opcode[1], opcode[2], 1);)
+OPCODE(0xd2, jmp_8080(state, opcode[1], opcode[2], 2);)
+OPCODE(0xda, jmp_8080(state, opcode[1], opcode[2], 3);)
+OPCODE(0xe2, jmp_8080(state, opcode[1], opcode[2], 4);)
+OPCODE(0xea, jmp_8080(state, opcode[1], opcode[2], 5);)
+OPCODE(0xf2, jmp_8080(state, opcode[1], opcode[2], 6);)
+OPCODE(0xfa, jmp_8080(state, opcode[1], opcode[2], 7);)
+
+// CALL addr
+OPCODE(0xcd, call_8080(state, opcode[1], opcode[2], 8);)
+
+// Ccondition addr (11 cycles, 17 when the call is taken)
+OPCODE(0xc4, if ( call_8080(state, opcode[1], opcode[2], 0) ) cycles += 6;)
+OPCODE(0xcc, if ( call_8080(state, opcode[1], opcode[2], 1) ) cycles += 6;)
+OPCODE(0xd4, if ( call_8080(state, opcode[1], opcode[2], 2) ) cycles += 6;)
+OPCODE(0xdc, if ( call_8080(state, opcode[1], opcode[2], 3) ) cycles += 6;)
+OPCODE(0xe4, if ( call_8080(state, opcode[1], opcode[2], 4) ) cycles += 6;)
+OPCODE(0xec, if ( call_8080(state, opcode[1], opcode[2], 5) ) cycles += 6;)
+OPCODE(0xf4, if ( call_8080(state, opcode[1], opcode[2], 6) ) cycles += 6;)
+OPCODE(0xfc, if ( call_8080(state, opcode[1], opcode[2], 7) ) cycles += 6;)
+
+// RET addr
+OPCODE(0xc9, ret_8080(state, 8);)
+
+// Rcondition addr (5 cycles, 11 when the return is taken)
+OPCODE(0xc0, if ( ret_8080(state, 0) ) cycles += 6;)
+OPCODE(0xc8, if ( ret_8080(state, 1) ) cycles += 6;)
+OPCODE(0xd0, if ( ret_8080(state, 2) ) cycles += 6;)
+OPCODE(0xd8, if ( ret_8080(state, 3) ) cycles += 6;)
+OPCODE(0xe0, if ( ret_8080(state, 4) ) cycles += 6;)
+OPCODE(0xe8, if ( ret_8080(state, 5) ) cycles += 6;)
+OPCODE(0xf0, if ( ret_8080(state, 6) ) cycles += 6;)
+OPCODE(0xf8, if ( ret_8080(state, 7) ) cycles += 6;)
+
+// RST n
+OPCODE(0xc7, rst_8080(state, 0);)
+OPCODE(0xcf, rst_8080(state, 1);)
+OPCODE(0xd7, rst_8080(state, 2);)
+OPCODE(0xdf, rst_8080(state, 3);)
+OPCODE(0xe7, rst_8080(state, 4);)
+OPCODE(0xef, rst_8080(state, 5);)
+OPCODE(0xf7, rst_8080(state, 6);)
+OPCODE(0xff, rst_8080(state, 7);)
+
+// PCHL
+OPCODE(0xe9, state->pc = combine_two_8bit(state->l, state->h);)
+
+// PUSH rp
+OPCODE(0xc5,
+	store_8080(state, (uint16_t)(state->sp - 1), state->b);
+	store_8080(state, (uint16_t)(state->sp - 2), state->c);
+	state->sp -= 2;
+)
+OPCODE(0xd5,
+	store_8080(state, (uint16_t)(state->sp - 1), state->d);
+	store_8080(state, (uint16_t)(state->sp - 2), state->e);
+	state->sp -= 2;
+)
+OPCODE(0xe5,
+	store_8080(state, (uint16_t)(state->sp - 1), state->h);
+	store_8080(state, (uint16_t)(state->sp - 2), state->l);
+	state->sp -= 2;
+)
+
+// PUSH PSW
+OPCODE(0xf5,
+	store_8080(state, (uint16_t)(state->sp - 1), state->a);
+	store_8080(state, (uint16_t)(state->sp - 2), psw_8080(state));
+	state->sp -= 2;
+)
+
+// POP rp
+OPCODE(0xc1,
+	state->c = state_mem[state->sp];
+	state->b = state_mem[(uint16_t)(state->sp + 1)];
+	state->sp += 2;
+)
+OPCODE(0xd1,
+	state->e = state_mem[state->sp];
+	state->d = state_mem[(uint16_t)(state->sp + 1)];
+	state->sp += 2;
+)
+OPCODE(0xe1,
+	state->l = state_mem[state->sp];
+	state->h = state_mem[(uint16_t)(state->sp + 1)];
+	state->sp += 2;
+)
+
+// POP PSW
+OPCODE(0xf1,
+	{
+		uint8_t word = state_mem[state->sp];
+		state->cf.cy = word & 0x1;
+		state->cf.p = (word >> 2) & 0x1;
+		state->cf.ac = (word >> 4) & 0x1;
+		state->cf.z = (word >> 6) & 0x1;
+		state->cf.s = (word >> 7) & 0x1;
+		state->lazy_pending = 0;
+	}
+	state->a = state_mem[(uint16_t)(state->sp + 1)];
+	state->sp += 2;
+)
+
+// XTHL
+OPCODE(0xe3,
+	{
+		uint8_t tmp = state_mem[state->sp];
+		store_8080(state, state->sp, state->l);
+		state->l = tmp;
+		tmp = state_mem[(uint16_t)(state->sp + 1)];
+		store_8080(state, (uint16_t)(state->sp + 1), state->h);
+		state->h = tmp;
+	}
+)
+
+// SPHL
+OPCODE(0xf9, state->sp = combine_two_8bit(state->l, state->h);)
+
+// IN port
+OPCODE(0xdb,
+	state->a = in_8080(state, opcode[1], ELAPSED_8080);
+	state->pc++;
+)
+
+// OUT port
+OPCODE(0xd3,
+	out_8080(state, opcode[1], state->a);
+	state->pc++;
+)
+
+// EI
+OPCODE(0xfb, state->int_enable = 1;)
+
+// DI
+OPCODE(0xf3, state->int_enable = 0;)
+
+// HLT
+OPCODE(0x76, unassigned_instruction(state);)
+
+// NOP
+OPCODE(0x00, )
+
+// Unused opcodes
+OPCODE(0x08, puts("missing instruction!!!");)
+OPCODE(0x10, puts("missing instruction!!!");)
+OPCODE(0x18, puts("missing instruction!!!");)
+OPCODE(0x20, puts("missing instruction!!!");)
+OPCODE(0x28, puts("missing instruction!!!");)
+OPCODE(0x30, puts("missing instruction!!!");)
+OPCODE(0x38, puts("missing instruction!!!");)
+OPCODE(0xcb, puts("missing instruction!!!");)
+OPCODE(0xd9, puts("missing instruction!!!");)
+OPCODE(0xdd, puts("missing instruction!!!");)
+OPCODE(0xed, puts("missing instruction!!!");)
+OPCODE(0xfd, puts("missing instruction!!!");)
@@ -0,0 +1,231 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "e8080_dissasemble.h"
+#include "profile_8080.h"
+
+/*
+ * Report for the profiles written by emulator_8080 -g: opcodes and then
+ * guest addresses, each sorted by the cycles spent on them and annotated
+ * with the disassembly. Build with:
+ *   cc -o profile_8080 profile_8080.c e8080_dissasemble.c -DE8080_DISSASEMBLE_NO_MAIN
+ *
+ * With -f it prints the call graph instead, in the folded format flame
+ * graph tools read: one line per call stack, outermost function first,
+ *   (top);0x0010;0x0a59 1234
+ * with the cycles spent in the innermost one. -s names functions from a
+ * file of "address name" lines (address in hex, '#' starts a comment).
+ */
+
+static struct Profile8080 profile;
+static uint8_t memory[MEMORY_SIZE_8080 + MEMORY_PADDING_8080];
+static const uint64_t *sort_cycles;
+static char *names[MEMORY_SIZE_8080];
+
+// Returns -1 if the file can't be read
+int load_symbols(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if ( f == NULL )
+	{
+		return -1;
+	}
+	char line[256];
+	while ( fgets(line, sizeof(line), f) != NULL )
+	{
+		char *comment = strchr(line, '#');
+		if ( comment != NULL )
+		{
+			*comment = '\0';
+		}
+		unsigned address;
+		char name[200];
+		if ( sscanf(line, "%x %199s", &address, name) == 2 && address < MEMORY_SIZE_8080 )
+		{
+			free(names[address]);
+			names[address] = strdup(name);
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+void print_function(uint16_t address)
+{
+	if ( names[address] != NULL )
+	{
+		printf("%s", names[address]);
+	}
+	else
+	{
+		printf("0x%04x", address);
+	}
+}
+
+// The frames of 'node' from the outermost, then its cycles
+void print_folded(uint32_t node)
+{
+	uint32_t path[PROFILE_8080_DEPTH + 1];
+	int depth = 0;
+	for ( uint32_t at = node; at != 0 && depth < PROFILE_8080_DEPTH; at = profile.tree[at].parent )
+	{
+		path[depth++] = at;
+	}
+	printf("(top)");
+	while ( depth > 0 )
+	{
+		putchar(';');
+		print_function(profile.tree[path[--depth]].function);
+	}
+	printf(" %llu\n", (unsigned long long)profile.tree[node].cycles);
+}
+
+// Most cycles first; ties by index so the order does not depend on qsort
+int by_cycles(const void *a, const void *b)
+{
+	int i = *(const int *)a;
+	int j = *(const int *)b;
+	if ( sort_cycles[i] != sort_cycles[j] )
+	{
+		return sort_cycles[i] < sort_cycles[j] ? 1 : -1;
+	}
+	return i - j;
+}
+
+// Indices of the nonzero entries of 'cycles', sorted; returns how many
+int sorted(const uint64_t *cycles, int size, int *order)
+{
+	int count = 0;
+	for ( int i = 0; i < size; i++ )
+	{
+		if ( cycles[i] != 0 )
+		{
+			order[count++] = i;
+		}
+	}
+	sort_cycles = cycles;
+	qsort(order, count, sizeof(int), by_cycles);
+	return count;
+}
+
+int main(int argc, char *argv[])
+{
+	// usage: profile_8080 [-n addresses] [-f] [-s symbol_file] profile_file
+	int lines = 50;
+	int folded = 0;
+	int opt;
+	while ( (opt = getopt(argc, argv, "n:fs:")) != -1 )
+	{
+		switch (opt)
+		{
+			case 'n': lines = atoi(optarg); break;
+			case 'f': folded = 1; break;
+			case 's':
+				if ( load_symbols(optarg) < 0 )
+				{
+					printf("error: Could not open %s\n", optarg);
+					exit(1);
+				}
+				break;
+			default:
+				printf("usage: %s [-n addresses] [-f] [-s symbol_file] profile_file\n", argv[0]);
+				exit(1);
+		}
+	}
+	if ( optind >= argc )
+	{
+		printf("usage: %s [-n addresses] [-f] [-s symbol_file] profile_file\n", argv[0]);
+		exit(1);
+	}
+	FILE *f = fopen(argv[optind], "rb");
+	if ( f == NULL )
+	{
+		printf("error: Could not open %s\n", argv[optind]);
+		exit(1);
+	}
+	uint32_t header[2];
+	if ( fread(header, sizeof(header), 1, f) != 1 || header[0] != PROFILE_8080_MAGIC || header[1] != PROFILE_8080_VERSION )
+	{
+		printf("error: %s is not a version %d profile\n", argv[optind], PROFILE_8080_VERSION);
+		exit(1);
+	}
+	if ( fread(&profile, sizeof(profile), 1, f) != 1 || fread(memory, MEMORY_SIZE_8080, 1, f) != 1 )
+	{
+		printf("error: %s is truncated\n", argv[optind]);
+		exit(1);
+	}
+	fclose(f);
+
+	if ( folded )
+	{
+		for ( uint32_t node = 0; node <= profile.nodes && node < PROFILE_8080_NODES; node++ )
+		{
+			if ( profile.tree[node].cycles != 0 )
+			{
+				print_folded(node);
+			}
+		}
+		return 0;
+	}
+
+	uint64_t instructions = 0;
+	uint64_t cycles = 0;
+	for ( int op = 0; op < 256; op++ )
+	{
+		instructions += profile.op_count[op];
+		cycles += profile.op_cycles[op];
+	}
+	printf("%llu instructions, %llu cycles\n", (unsigned long long)instructions, (unsigned long long)cycles);
+	if ( profile.unfollowed != 0 )
+	{
+		printf("%llu calls did not fit in the call graph and were counted in their caller\n", (unsigned long long)profile.unfollowed);
+	}
+	if ( cycles == 0 )
+	{
+		return 0;
+	}
+
+	// each opcode is shown as it appears at the address where it took the most cycles
+	static uint64_t hottest_cycles[256];
+	static int hottest[256];
+	for ( int pc = 0; pc < MEMORY_SIZE_8080; pc++ )
+	{
+		uint8_t op = memory[pc];
+		if ( profile.pc_cycles[pc] > hottest_cycles[op] )
+		{
+			hottest_cycles[op] = profile.pc_cycles[pc];
+			hottest[op] = pc;
+		}
+	}
+	static int order[MEMORY_SIZE_8080];
+	int count = sorted(profile.op_cycles, 256, order);
+	printf("\nopcodes by cycles\n  %%cycles       cycles        count  op  hottest at\n");
+	for ( int i = 0; i < count; i++ )
+	{
+		int op = order[i];
+		printf("%8.2f%% %12llu %12llu  %02x  ", 100.0 * profile.op_cycles[op] / cycles, (unsigned long long)profile.op_cycles[op], (unsigned long long)profile.op_count[op], op);
+		if ( hottest_cycles[op] != 0 )
+		{
+			e8080_dissasemble_opcode(memory, hottest[op]);
+		}
+		else
+		{
+			// the code it ran in was overwritten since
+			unsigned char code[3] = { op, 0, 0 };
+			e8080_dissasemble_instruction(code, 0);
+		}
+	}
+
+	count = sorted(profile.pc_cycles, MEMORY_SIZE_8080, order);
+	printf("\naddresses by cycles (%d of %d run)\n  %%cycles       cycles        count  instruction\n", count < lines ? count : lines, count);
+	for ( int i = 0; i < count && i < lines; i++ )
+	{
+		int pc = order[i];
+		printf("%8.2f%% %12llu %12llu  ", 100.0 * profile.pc_cycles[pc] / cycles, (unsigned long long)profile.pc_cycles[pc], (unsigned long long)profile.pc_count[pc]);
+		e8080_dissasemble_opcode(memory, pc);
+	}
+	return 0;
+}
@@ -0,0 +1,126 @@
+#ifndef PROFILE_8080_H
+#define PROFILE_8080_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "emulator_8080.h"
+
+// Written at the start of a profile file, followed by struct Profile8080 and
+// the MEMORY_SIZE_8080 bytes of guest memory the addresses refer to
+#define PROFILE_8080_MAGIC 0x38303850u  // "P808"
+#define PROFILE_8080_VERSION 2
+
+/*
+ * The call graph is a tree with a node per call stack seen, each holding the
+ * cycles spent in its innermost function. A shadow stack follows the guest:
+ * a taken CALL, an RST or an interrupt enters the node for the address
+ * called, and a taken return leaves every frame whose return address it
+ * popped, by comparing stack pointers. That also drops frames left behind by
+ * code that discards its return address, at the next return below them.
+ * Calls past PROFILE_8080_DEPTH frames or PROFILE_8080_NODES stacks are
+ * counted in the caller.
+ */
+#define PROFILE_8080_NODES 16384    // power of two
+#define PROFILE_8080_DEPTH 256
+
+struct ProfileNode8080 {
+	uint32_t parent;
+	uint32_t next;              // next node in the same bucket, 0 for none
+	uint16_t function;          // address called
+	uint64_t cycles;            // spent in the function itself on this stack
+};
+
+struct ProfileFrame8080 {
+	uint32_t node;
+	uint16_t sp;                // where the return address is
+};
+
+// Instructions run and the cycles they took, by opcode, by address and by
+// call stack. All zero is an empty profile.
+struct Profile8080 {
+	uint64_t op_count[256];
+	uint64_t op_cycles[256];
+	uint64_t pc_count[MEMORY_SIZE_8080];
+	uint64_t pc_cycles[MEMORY_SIZE_8080];
+	// tree[0] is the code that was never called, e.g. from reset
+	uint32_t node;              // current call stack
+	uint32_t nodes;             // in use besides tree[0]
+	uint32_t depth;
+	uint64_t unfollowed;        // calls counted in the caller for lack of room
+	struct ProfileFrame8080 stack[PROFILE_8080_DEPTH];
+	uint32_t buckets[PROFILE_8080_NODES];   // first node of each (parent, function) hash
+	struct ProfileNode8080 tree[PROFILE_8080_NODES];
+};
+
+static inline void profile_8080_enter(struct Profile8080 *profile, uint16_t function, uint16_t sp)
+{
+	uint32_t parent = profile->node;
+	uint32_t *bucket = &profile->buckets[((parent << 16 ^ function) * 0x9e3779b1u) >> 16 & (PROFILE_8080_NODES - 1)];
+	uint32_t node = *bucket;
+	while ( node != 0 && (profile->tree[node].parent != parent || profile->tree[node].function != function) )
+	{
+		node = profile->tree[node].next;
+	}
+	if ( node == 0 )
+	{
+		if ( profile->nodes == PROFILE_8080_NODES - 1 )
+		{
+			profile->unfollowed++;
+			return;
+		}
+		node = ++profile->nodes;
+		profile->tree[node] = (struct ProfileNode8080){ parent, *bucket, function, 0 };
+		*bucket = node;
+	}
+	if ( profile->depth == PROFILE_8080_DEPTH )
+	{
+		profile->unfollowed++;
+		return;
+	}
+	profile->stack[profile->depth++] = (struct ProfileFrame8080){ node, sp };
+	profile->node = node;
+}
+
+// After a return left the stack pointer at 'sp'
+static inline void profile_8080_leave(struct Profile8080 *profile, uint16_t sp)
+{
+	while ( profile->depth > 0 && profile->stack[profile->depth - 1].sp < sp )
+	{
+		profile->depth--;
+	}
+	profile->node = profile->depth > 0 ? profile->stack[profile->depth - 1].node : 0;
+}
+
+// One instruction at 'pc' that took 'cycles', with 'state' as it left it
+static inline void profile_8080_count(struct Profile8080 *profile, struct State8080 *state, uint16_t pc, uint8_t op, int cycles)
+{
+	profile->op_count[op]++;
+	profile->op_cycles[op] += cycles;
+	profile->pc_count[pc]++;
+	profile->pc_cycles[pc] += cycles;
+	profile->tree[profile->node].cycles += cycles;
+	// conditional calls and returns take longer when taken
+	int taken = cycles != cycles_8080[op];
+	if ( op == 0xcd || (op & 0xc7) == 0xc7 || ((op & 0xc7) == 0xc4 && taken) )
+	{
+		profile_8080_enter(profile, state->pc, state->sp);
+	}
+	else if ( op == 0xc9 || ((op & 0xc7) == 0xc0 && taken) )
+	{
+		profile_8080_leave(profile, state->sp);
+	}
+}
+
+// Writes the counts and 'memory' to 'f'; returns 0 on success
+static inline int profile_8080_write(const struct Profile8080 *profile, const uint8_t *memory, FILE *f)
+{
+	uint32_t header[2] = { PROFILE_8080_MAGIC, PROFILE_8080_VERSION };
+	if ( fwrite(header, sizeof(header), 1, f) != 1 || fwrite(profile, sizeof(*profile), 1, f) != 1 || fwrite(memory, MEMORY_SIZE_8080, 1, f) != 1 )
+	{
+		return -1;
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,374 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "emulator_8080.h"
+#include "invaders_8080.h"
+#include "e8080_dissasemble.h"
+
+/*
+ * Ahead-of-time recompiler: writes the code of a ROM out as a C function
+ * with the contract of run_for_cycles_8080 (see recompiled_8080.h), to be
+ * compiled into the emulator. Code is found by following every branch from
+ * the entry points (0 and the RST vectors unless -e gives others); what is
+ * not reached that way, and code in RAM, is interpreted.
+ * Build with:
+ *   cc -O2 -o recompile_8080 recompile_8080.c emulator_8080.c invaders_8080.c e8080_dissasemble.c -DEMULATOR_8080_NO_MAIN -DE8080_DISSASEMBLE_NO_MAIN
+ */
+
+#define MAX_ENTRIES 64
+
+// marks[] bits
+#define CODE 0x1        // an instruction starts here
+#define TARGET 0x2      // and the generated code has a goto to it
+
+static uint8_t *memory;
+static uint8_t rom[MEMORY_SIZE_8080];       // nonzero: loaded from an image
+static uint8_t marks[MEMORY_SIZE_8080];
+
+static int in_rom(uint16_t addr, int size)
+{
+	for ( int i = 0; i < size; i++ )
+	{
+		if ( addr + i >= MEMORY_SIZE_8080 || !rom[addr + i] )
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Where the instruction at 'addr' goes when it branches, if that is known
+// before it runs; -1 otherwise
+static int branch_target(uint16_t addr)
+{
+	uint8_t op = memory[addr];
+	if ( op == 0xc3 || op == 0xcd || (op & 0xc7) == 0xc2 || (op & 0xc7) == 0xc4 )
+	{
+		return combine_two_8bit(memory[addr + 1], memory[addr + 2]);
+	}
+	if ( (op & 0xc7) == 0xc7 )
+	{
+		return op & 0x38;   // RST n
+	}
+	return -1;
+}
+
+// JMP, RET, PCHL and HLT never go on to the next instruction
+static int ends_flow(uint8_t op)
+{
+	return op == 0xc3 || op == 0xc9 || op == 0xe9 || op == 0x76;
+}
+
+static int unconditional(uint8_t op)
+{
+	return op == 0xc3 || op == 0xcd || (op & 0xc7) == 0xc7;
+}
+
+static void discover(uint16_t entry)
+{
+	// every address is pushed at most once per instruction marked, so this can't overflow
+	static uint16_t stack[MEMORY_SIZE_8080];
+	int top = 0;
+	stack[top++] = entry;
+	while ( top > 0 )
+	{
+		uint16_t addr = stack[--top];
+		while ( !(marks[addr] & CODE) )
+		{
+			uint8_t op = memory[addr];
+			int size = e8080_instruction_size(op);
+			if ( !in_rom(addr, size) )
+			{
+				break;
+			}
+			marks[addr] |= CODE;
+			int target = branch_target(addr);
+			if ( target >= 0 )
+			{
+				stack[top++] = target;
+			}
+			if ( ends_flow(op) )
+			{
+				break;
+			}
+			addr += size;
+		}
+	}
+}
+
+// The next instruction in address order; the generated cases are in this order
+static int following(int addr)
+{
+	for ( addr++; addr < MEMORY_SIZE_8080; addr++ )
+	{
+		if ( marks[addr] & CODE )
+		{
+			return addr;
+		}
+	}
+	return -1;
+}
+
+// Marks the instructions the generated code jumps to, so exactly those get labels
+static void mark_targets(void)
+{
+	for ( int addr = 0; addr < MEMORY_SIZE_8080; addr++ )
+	{
+		if ( !(marks[addr] & CODE) )
+		{
+			continue;
+		}
+		uint8_t op = memory[addr];
+		int target = branch_target(addr);
+		if ( target >= 0 && (marks[target] & CODE) )
+		{
+			marks[target] |= TARGET;
+		}
+		int next = addr + e8080_instruction_size(op);
+		if ( !ends_flow(op) && !unconditional(op) && next != following(addr) && (marks[next] & CODE) )
+		{
+			marks[next] |= TARGET;
+		}
+	}
+}
+
+// Nonzero if the instruction at 'addr' is the last of its block: it branches,
+// takes a variable number of cycles, or is followed by a jump target
+static int ends_block(uint16_t addr)
+{
+	uint8_t op = memory[addr];
+	int next = addr + e8080_instruction_size(op);
+	return branch_target(addr) >= 0 || ends_flow(op) || (op & 0xc7) == 0xc0 || next != following(addr) || (marks[next] & TARGET);
+}
+
+// Cycles from the instruction at 'addr' up to the last one of its block
+static int rest_of_block(uint16_t addr)
+{
+	int rest = 0;
+	while ( !ends_block(addr) )
+	{
+		rest += cycles_8080[memory[addr]];
+		addr += e8080_instruction_size(memory[addr]);
+	}
+	return rest;
+}
+
+static void emit_goto(int addr)
+{
+	if ( addr >= 0 && (marks[addr] & CODE) )
+	{
+		printf("\t\tgoto L_0x%04x;\n", addr);
+	}
+	else
+	{
+		printf("\t\tgoto dispatch;\n");
+	}
+}
+
+static void emit_instruction(uint16_t addr, int first)
+{
+	uint8_t op = memory[addr];
+	int size = e8080_instruction_size(op);
+	int next = addr + size;
+	int target = branch_target(addr);
+
+	printf("\t// ");
+	e8080_dissasemble_instruction(&memory[addr], addr);
+	if ( first )
+	{
+		printf("\tcase 0x%04x:", addr);
+		if ( marks[addr] & TARGET )
+		{
+			printf(" L_0x%04x:", addr);
+		}
+		printf("\n\t\tRECOMPILED_8080_BLOCK(0x%04x, %d)\n", addr, rest_of_block(addr));
+	}
+	else
+	{
+		printf("\t\tRECOMPILED_8080_RESUME(0x%04x, %d)\n", addr, rest_of_block(addr));
+	}
+	printf("\t\tRECOMPILED_8080_STEP(0x%04x, 0x%02x, %d, 0x%02x, 0x%02x)\n", addr, op, cycles_8080[op], size > 1 ? memory[addr + 1] : 0, size > 2 ? memory[addr + 2] : 0);
+
+	// the body has set pc; turn what it can be into gotos
+	if ( ends_flow(op) && op != 0xc3 )
+	{
+		printf("\t\tgoto dispatch;\n");
+		return;
+	}
+	if ( target >= 0 && unconditional(op) )
+	{
+		emit_goto(target);
+		return;
+	}
+	if ( target >= 0 )
+	{
+		printf("\t\tif ( state->pc == 0x%04x )\n\t\t{\n\t", target);
+		emit_goto(target);
+		printf("\t\t}\n");
+	}
+	else if ( (op & 0xc7) == 0xc0 )
+	{
+		// Rcc
+		printf("\t\tif ( state->pc != 0x%04x )\n\t\t{\n\t\t\tgoto dispatch;\n\t\t}\n", next & 0xffff);
+	}
+	if ( next != following(addr) )
+	{
+		emit_goto(next < MEMORY_SIZE_8080 ? next : -1);
+	}
+	else if ( ends_block(addr) )
+	{
+		// on into the next block's case
+		printf("\t\tRECOMPILED_8080_FALLTHROUGH();\n");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	// usage: recompile_8080 [-n name] [-e entry]... [-o out.c] (-r rom_dir | rom[@origin]...)
+	const char *name = "rom";
+	const char *out_path = NULL;
+	const char *rom_dir = NULL;
+	int entries[MAX_ENTRIES];
+	int entry_count = 0;
+	int opt;
+	while ( (opt = getopt(argc, argv, "n:e:o:r:")) != -1 )
+	{
+		switch (opt)
+		{
+			case 'n': name = optarg; break;
+			case 'e':
+				if ( entry_count == MAX_ENTRIES )
+				{
+					printf("error: More than %d entry points\n", MAX_ENTRIES);
+					exit(1);
+				}
+				entries[entry_count++] = strtol(optarg, NULL, 0) & 0xffff;
+				break;
+			case 'o': out_path = optarg; break;
+			case 'r': rom_dir = optarg; break;
+			default:
+				printf("usage: %s [-n name] [-e entry]... [-o out.c] (-r rom_dir | rom[@origin]...)\n", argv[0]);
+				exit(1);
+		}
+	}
+	if ( optind >= argc && rom_dir == NULL )
+	{
+		printf("usage: %s [-n name] [-e entry]... [-o out.c] (-r rom_dir | rom[@origin]...)\n", argv[0]);
+		exit(1);
+	}
+	if ( entry_count == 0 )
+	{
+		// reset and the RST vectors interrupts jump to
+		for ( int nnn = 0; nnn < 8; nnn++ )
+		{
+			entries[entry_count++] = nnn << 3;
+		}
+	}
+
+	int count = rom_dir != NULL ? INVADERS_ROM_PARTS : argc - optind;
+	struct RomPart8080 parts[count];
+	char paths[count][4096];
+	int sizes[count];
+	for ( int i = 0; i < count; i++ )
+	{
+		if ( rom_dir != NULL )
+		{
+			snprintf(paths[i], sizeof(paths[i]), "%s/%s", rom_dir, invaders_rom_set[i].path);
+			parts[i].origin = invaders_rom_set[i].origin;
+		}
+		else
+		{
+			// each image is loaded at address 0 unless an origin follows an '@'
+			char *at = strrchr(argv[optind + i], '@');
+			parts[i].origin = 0;
+			if ( at != NULL )
+			{
+				*at = '\0';
+				parts[i].origin = strtol(at + 1, NULL, 0);
+			}
+			snprintf(paths[i], sizeof(paths[i]), "%s", argv[optind + i]);
+		}
+		parts[i].path = paths[i];
+	}
+
+	memory = alloc_memory_8080();
+	if ( memory == NULL )
+	{
+		puts("error: Could not allocate guest memory");
+		exit(1);
+	}
+	for ( int i = 0; i < count; i++ )
+	{
+		sizes[i] = load_rom_8080(memory, parts[i].path, parts[i].origin, ROM_MMAP_8080);
+		if ( sizes[i] < 0 )
+		{
+			exit(1);
+		}
+		memset(&rom[parts[i].origin], 1, sizes[i]);
+	}
+	for ( int i = 0; i < entry_count; i++ )
+	{
+		discover(entries[i]);
+	}
+	mark_targets();
+
+	// the disassembler prints to stdout, so the output file takes its place
+	if ( out_path != NULL && freopen(out_path, "w", stdout) == NULL )
+	{
+		fprintf(stderr, "error: Could not write %s\n", out_path);
+		exit(1);
+	}
+	int instructions = 0;
+	for ( int addr = 0; addr < MEMORY_SIZE_8080; addr++ )
+	{
+		instructions += marks[addr] & CODE;
+	}
+	printf("/*\n * %s recompiled by recompile_8080 from", name);
+	for ( int i = 0; i < count; i++ )
+	{
+		printf(" %s@0x%04x", parts[i].path, parts[i].origin);
+	}
+	printf("\n * %d instructions. Generated code; do not edit.\n */\n", instructions);
+	printf("#include \"recompiled_8080.h\"\n\n");
+	for ( int i = 0; i < count; i++ )
+	{
+		printf("static const uint8_t image_%d[%d] = {", i, sizes[i]);
+		for ( int j = 0; j < sizes[i]; j++ )
+		{
+			printf("%s0x%02x,", j % 16 ? " " : "\n\t", memory[parts[i].origin + j]);
+		}
+		printf("\n};\n\n");
+	}
+	printf("static const struct RecompiledRom8080 images[%d] = {\n", count);
+	for ( int i = 0; i < count; i++ )
+	{
+		printf("\t{ 0x%04x, %d, image_%d },\n", parts[i].origin, sizes[i], i);
+	}
+	printf("};\n\n");
+
+	printf("int run_%s_8080(struct State8080 *state, int budget)\n{\n", name);
+	printf("\tRECOMPILED_8080_ENTER(images, %d)\n", count);
+	printf("\tRECOMPILED_8080_DISPATCH()\n");
+	int previous_end = -1;
+	int first = 1;
+	for ( int addr = 0; addr < MEMORY_SIZE_8080; addr++ )
+	{
+		if ( !(marks[addr] & CODE) )
+		{
+			continue;
+		}
+		if ( addr != previous_end )
+		{
+			printf("\n\t// $%04x\n", addr);
+		}
+		emit_instruction(addr, first);
+		first = ends_block(addr);
+		previous_end = addr + e8080_instruction_size(memory[addr]);
+	}
+	printf("\tRECOMPILED_8080_LEAVE()\n}\n");
+	free_memory_8080(memory);
+	return 0;
+}
@@ -0,0 +1,150 @@
+#ifndef RECOMPILED_8080_H
+#define RECOMPILED_8080_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emulator_8080.h"
+#include "helpers_8080.h"
+
+/*
+ * Support for the C files recompile_8080 writes; nothing else includes it.
+ *
+ * A recompiled ROM is one function with the contract of run_for_cycles_8080.
+ * It is a switch on pc with a case for every instruction found in the ROM,
+ * each running the same body as the interpreter (the body_0xNN functions
+ * of helpers_8080.h) with its operands as constants.
+ * Straight-line code falls through to the next case and branches with a
+ * known target are gotos, so the compiler sees whole routines. Returns,
+ * PCHL and any address that was not recompiled (RAM, or ROM never reached
+ * from an entry point) go back through the switch; addresses without a case
+ * run one instruction in emulate_8080.
+ *
+ * The result is the same instruction for instruction and cycle for cycle
+ * as run_for_cycles_8080 with the same budget.
+ */
+
+// A loaded ROM image; the recompiled code is only used while guest memory
+// still holds these bytes
+struct RecompiledRom8080 {
+	uint16_t origin;
+	uint16_t size;
+	const uint8_t *bytes;
+};
+
+// Nonzero if guest memory holds every image as it was recompiled
+static inline int recompiled_8080_matches(const uint8_t *memory, const struct RecompiledRom8080 *roms, int count)
+{
+	for ( int i = 0; i < count; i++ )
+	{
+		if ( memcmp(&memory[roms[i].origin], roms[i].bytes, roms[i].size) != 0 )
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * The pieces of a recompiled function, used in this order:
+ *
+ *   RECOMPILED_8080_ENTER(images, count)   interprets when tracing, profiling
+ *                                          or when the ROM was changed
+ *   RECOMPILED_8080_DISPATCH()             then, for each instruction,
+ *   case 0xNNNN: RECOMPILED_8080_BLOCK(0xNNNN, rest)         (first of a block)
+ *   RECOMPILED_8080_RESUME(0xNNNN, rest)                     (any other)
+ *   RECOMPILED_8080_STEP(0xNNNN, 0xOP, cycles, byte1, byte2)
+ *   RECOMPILED_8080_FALLTHROUGH();         (before the next case, when the
+ *                                          last block runs on into it)
+ *   RECOMPILED_8080_LEAVE()
+ *
+ * with 'goto dispatch' wherever the next pc is only known at run time.
+ *
+ * A block is straight-line code whose last instruction is the only one that
+ * branches or takes a variable number of cycles, and 'rest' is the cycles
+ * from an instruction up to that last one. When they don't fit in what is
+ * left of the budget, the interpreter takes over for the last few
+ * instructions, so the ones run are exactly those run_for_cycles_8080 would
+ * have run without a check per instruction.
+ *
+ * Memory is checked against the images on the first call for a machine,
+ * and again after initialize_state or restore_8080, and the result kept in
+ * state->recompiled: a guest write to the ROM in between is not noticed
+ * (load it with ROM_PROTECT_8080 to make such a write fault).
+ */
+#define RECOMPILED_8080_ENTER(images, count) \
+	if ( state->recompiled == 0 ) \
+	{ \
+		state->recompiled = recompiled_8080_matches(state->memory, images, count) ? 1 : -1; \
+	} \
+	if ( state->recompiled < 0 || state->trace || state->profile ) \
+	{ \
+		return run_for_cycles_8080(state, budget); \
+	} \
+	uint8_t *state_mem = state->memory; \
+	int cycles = 0;
+
+#define RECOMPILED_8080_DISPATCH() \
+dispatch: \
+	if ( cycles >= budget ) \
+	{ \
+		goto out; \
+	} \
+	switch ( state->pc ) \
+	{ \
+		default: \
+		{ \
+			/* emulate_8080 counts its own cycles from state->cycles; the */ \
+			/* cycles are taken back out to be added with the rest at out */ \
+			state->cycles += cycles; \
+			int taken = emulate_8080(state); \
+			state->cycles -= cycles + taken; \
+			cycles += taken; \
+			goto dispatch; \
+		}
+
+#define RECOMPILED_8080_BLOCK(addr, rest) \
+	if ( cycles + (rest) >= budget ) \
+	{ \
+		state->pc = addr; \
+		goto slow; \
+	}
+
+// Straight-line code falls through; only the switch enters here
+#define RECOMPILED_8080_RESUME(addr, rest) \
+	if ( 0 ) \
+	{ \
+		case addr: \
+		RECOMPILED_8080_BLOCK(addr, rest) \
+	}
+
+#define RECOMPILED_8080_STEP(addr, op, clocks, byte1, byte2) \
+	state->pc = (addr) + 1; \
+	cycles += (clocks) + body_##op(state, state_mem, (const unsigned char[]){ op, byte1, byte2 }, cycles);
+
+#ifdef __has_attribute
+#if __has_attribute(fallthrough)
+#define RECOMPILED_8080_FALLTHROUGH() __attribute__((fallthrough))
+#endif
+#endif
+#ifndef RECOMPILED_8080_FALLTHROUGH
+#define RECOMPILED_8080_FALLTHROUGH()
+#endif
+
+#define RECOMPILED_8080_LEAVE() \
+	} \
+	goto dispatch; \
+slow: \
+	state->cycles += cycles; \
+	while ( cycles < budget ) \
+	{ \
+		cycles += emulate_8080(state); \
+	} \
+	return cycles; \
+out: \
+	state->cycles += cycles; \
+	return cycles;
+
+#endif
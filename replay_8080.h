@@ -0,0 +1,113 @@
+#ifndef REPLAY_8080_H
+#define REPLAY_8080_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emulator_8080.h"
+
+/*
+ * Input log: every IN the CPU runs while state->replay is set is either
+ * recorded (the value the device returned) or played back (the value
+ * recorded, without reading the device), so a session runs again exactly as
+ * it did, as fast as the host allows.
+ *
+ * Each read is stamped with the cycle count at the start of its IN. The
+ * loops that keep their count locally hand it in (ELAPSED_8080 in
+ * opcodes_8080.h, the translator's running count), so every loop writes the
+ * same log for the same session. Playback checks the port and the stamp of
+ * every read, and the first one that doesn't match (or a read past the end)
+ * marks the log as diverged. From then on reads go to the devices.
+ *
+ * A log file is
+ *   0   "I808", version (32 bit), number of reads (64 bit), little-endian
+ *   16  one record per read:
+ *         varint   cycles since the previous read << 1 | same
+ *         port
+ *         value    only when 'same' is 0, i.e. the port returned
+ *                  something else than the last time it was read
+ * where a varint is 7 bits per byte, low bits first, bit 7 set on every
+ * byte but the last.
+ */
+#define REPLAY_8080_MAGIC "I808"
+#define REPLAY_8080_VERSION 2
+#define REPLAY_8080_HEADER 16
+
+#define REPLAY_8080_RECORD 1
+#define REPLAY_8080_PLAY 2
+
+struct Replay8080 {
+	int mode;                   // REPLAY_8080_RECORD or REPLAY_8080_PLAY
+	int diverged;               // playback: a read did not match the log
+	uint8_t *bytes;             // records, without the file header
+	size_t size;                // bytes of records
+	size_t capacity;            // recording: bytes allocated
+	size_t at;                  // playback: next record
+	uint64_t reads;             // reads recorded or played back so far
+	uint64_t cycles;            // stamp of the last of those reads
+	uint8_t last[256];          // value of the last of those reads per port
+};
+
+// An empty log to record into
+static inline void replay_8080_record(struct Replay8080 *replay)
+{
+	*replay = (struct Replay8080){ .mode = REPLAY_8080_RECORD };
+}
+
+static inline void replay_8080_free(struct Replay8080 *replay)
+{
+	free(replay->bytes);
+	replay->bytes = NULL;
+	replay->size = replay->capacity = 0;
+}
+
+// Writes what was recorded to 'f'; returns 0 on success
+static inline int replay_8080_write(const struct Replay8080 *replay, FILE *f)
+{
+	uint8_t header[REPLAY_8080_HEADER] = REPLAY_8080_MAGIC;
+	put_le_8080(&header[4], REPLAY_8080_VERSION, 4);
+	put_le_8080(&header[8], replay->reads, 8);
+	if ( fwrite(header, sizeof(header), 1, f) != 1 )
+	{
+		return -1;
+	}
+	if ( replay->size != 0 && fwrite(replay->bytes, replay->size, 1, f) != 1 )
+	{
+		return -1;
+	}
+	return 0;
+}
+
+// Loads a log written by replay_8080_write for playback; returns the number
+// of reads it holds, or -1 if 'f' holds no log of this version
+static inline long long replay_8080_read(struct Replay8080 *replay, FILE *f)
+{
+	uint8_t header[REPLAY_8080_HEADER];
+	if ( fread(header, sizeof(header), 1, f) != 1 || memcmp(header, REPLAY_8080_MAGIC, 4) != 0 || get_le_8080(&header[4], 4) != REPLAY_8080_VERSION )
+	{
+		return -1;
+	}
+	*replay = (struct Replay8080){ .mode = REPLAY_8080_PLAY };
+	size_t got;
+	do
+	{
+		if ( replay->size == replay->capacity )
+		{
+			replay->capacity = replay->capacity ? replay->capacity * 2 : 65536;
+			uint8_t *bytes = realloc(replay->bytes, replay->capacity);
+			if ( bytes == NULL )
+			{
+				replay_8080_free(replay);
+				return -1;
+			}
+			replay->bytes = bytes;
+		}
+		got = fread(replay->bytes + replay->size, 1, replay->capacity - replay->size, f);
+		replay->size += got;
+	} while ( got != 0 );
+	return get_le_8080(&header[8], 8);
+}
+
+#endif
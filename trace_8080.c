@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "e8080_dissasemble.h"
+#include "trace_8080.h"
+
+/*
+ * Offline decoder for the binary traces written by emulator_8080 -t.
+ * Build with:
+ *   cc -o trace_8080 trace_8080.c e8080_dissasemble.c -DE8080_DISSASEMBLE_NO_MAIN
+ */
+
+void print_entry(struct TraceEntry8080 *entry)
+{
+	e8080_dissasemble_instruction(entry->code, entry->pc);
+	printf("\tC=%d,P=%d,AC=%d,Z=%d,S=%d\n", entry->psw & 0x1, (entry->psw >> 2) & 0x1, (entry->psw >> 4) & 0x1, (entry->psw >> 6) & 0x1, entry->psw >> 7);
+	printf("\tA $%02x B $%02x C $%02x D $%02x E $%02x H $%02x L $%02x SP %04x\n", entry->a, entry->b, entry->c, entry->d, entry->e, entry->h, entry->l, entry->sp);
+}
+
+int main(int argc, char *argv[])
+{
+	// usage: trace_8080 trace_file
+	if ( argc != 2 )
+	{
+		printf("usage: %s trace_file\n", argv[0]);
+		exit(1);
+	}
+	FILE *f = fopen(argv[1], "rb");
+	if ( f == NULL )
+	{
+		printf("error: Could not open %s\n", argv[1]);
+		exit(1);
+	}
+
+	uint32_t header[3];
+	if ( fread(header, sizeof(header), 1, f) != 1 || header[0] != TRACE_8080_MAGIC || header[1] != TRACE_8080_VERSION )
+	{
+		printf("error: %s is not a version %d trace\n", argv[1], TRACE_8080_VERSION);
+		exit(1);
+	}
+
+	// registers are recorded before each instruction executes
+	struct TraceEntry8080 entry;
+	for ( uint32_t i = 0; i < header[2]; i++ )
+	{
+		if ( fread(&entry, sizeof(entry), 1, f) != 1 )
+		{
+			printf("error: trace truncated after %u entries\n", i);
+			exit(1);
+		}
+		print_entry(&entry);
+	}
+	fclose(f);
+	return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef TRACE_8080_H
+#define TRACE_8080_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Number of instructions kept in the ring; must be a power of two
+#define TRACE_8080_SIZE 4096
+
+// Written at the start of a trace file, followed by the entries oldest first
+#define TRACE_8080_MAGIC 0x38303854u  // "T808"
+#define TRACE_8080_VERSION 1
+
+// One executed instruction and the registers it started with
+struct TraceEntry8080 {
+	uint16_t pc;
+	uint8_t code[3];            // opcode and up to two operand bytes
+	uint8_t psw;                // flags packed the same way PUSH PSW stores them
+	uint8_t a;
+	uint8_t b;
+	uint8_t c;
+	uint8_t d;
+	uint8_t e;
+	uint8_t h;
+	uint8_t l;
+	uint8_t pad;
+	uint16_t sp;
+};  // sizeof is 16
+
+struct Trace8080 {
+	uint64_t next;              // total number of entries ever recorded
+	struct TraceEntry8080 entries[TRACE_8080_SIZE];
+};
+
+static inline struct TraceEntry8080 *trace_8080_next(struct Trace8080 *trace)
+{
+	return &trace->entries[trace->next++ & (TRACE_8080_SIZE - 1)];
+}
+
+// Writes the ring to 'f' in execution order; returns 0 on success
+static inline int trace_8080_write(const struct Trace8080 *trace, FILE *f)
+{
+	uint32_t count = trace->next < TRACE_8080_SIZE ? (uint32_t)trace->next : TRACE_8080_SIZE;
+	uint32_t first = (trace->next - count) & (TRACE_8080_SIZE - 1);
+	uint32_t header[3] = { TRACE_8080_MAGIC, TRACE_8080_VERSION, count };
+	if ( fwrite(header, sizeof(header), 1, f) != 1 )
+	{
+		return -1;
+	}
+	// the ring may wrap, in which case the oldest entries are at the end
+	uint32_t tail = TRACE_8080_SIZE - first;
+	if ( tail > count )
+	{
+		tail = count;
+	}
+	if ( fwrite(&trace->entries[first], sizeof(struct TraceEntry8080), tail, f) != tail )
+	{
+		return -1;
+	}
+	if ( fwrite(&trace->entries[0], sizeof(struct TraceEntry8080), count - tail, f) != count - tail )
+	{
+		return -1;
+	}
+	return 0;
+}
+
+#endif